@@ -16,10 +16,10 @@
 
 using namespace std;
 
-size_t counter_ntt_forward = 0;
-size_t counter_ntt_inverse = 0;
-std::chrono::nanoseconds time_ntt_forward = chrono::nanoseconds::zero();
-std::chrono::nanoseconds time_ntt_inverse = chrono::nanoseconds::zero();
+atomic<size_t> counter_ntt_forward{ 0 };
+atomic<size_t> counter_ntt_inverse{ 0 };
+atomic<chrono::nanoseconds::rep> time_ntt_forward{ 0 };
+atomic<chrono::nanoseconds::rep> time_ntt_inverse{ 0 };
 
 #ifdef SEAL_USE_INTEL_HEXL
 namespace intel
@@ -440,7 +440,7 @@ namespace seal
                 }
             });
 #endif
-            time_ntt_forward += chrono::steady_clock::now() - begin;
+            time_ntt_forward += (chrono::steady_clock::now() - begin).count();
         }
 
         void inverse_ntt_negacyclic_harvey_lazy(CoeffIter operand, const NTTTables &tables)
@@ -481,7 +481,7 @@ namespace seal
                 }
             });
 #endif
-            time_ntt_inverse += chrono::steady_clock::now() - begin;
+            time_ntt_inverse += (chrono::steady_clock::now() - begin).count();
         }
     } // namespace util
 } // namespace seal
@@ -11,12 +11,15 @@
 #include "seal/util/pointer.h"
 #include "seal/util/uintarithsmallmod.h"
 #include "seal/util/uintcore.h"
+#include <atomic>
+#include <chrono>
 #include <stdexcept>
 
-extern size_t counter_ntt_forward;
-extern size_t counter_ntt_inverse;
-extern std::chrono::nanoseconds time_ntt_forward;
-extern std::chrono::nanoseconds time_ntt_inverse;
+// Operation counters are updated concurrently when callers run NTTs from several threads.
+extern std::atomic<size_t> counter_ntt_forward;
+extern std::atomic<size_t> counter_ntt_inverse;
+extern std::atomic<std::chrono::nanoseconds::rep> time_ntt_forward;
+extern std::atomic<std::chrono::nanoseconds::rep> time_ntt_inverse;
 
 namespace seal
 {
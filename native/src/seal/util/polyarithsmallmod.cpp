@@ -4,6 +4,7 @@
 #include "seal/util/polyarithsmallmod.h"
 #include "seal/util/uintarith.h"
 #include "seal/util/uintcore.h"
+#include <limits>
 
 #ifdef SEAL_USE_INTEL_HEXL
 #include "hexl/hexl.hpp"
@@ -15,14 +16,14 @@ namespace seal
 {
     namespace util
     {
-        size_t counter_poly_add = 0;
-        size_t counter_poly_sub = 0;
-        size_t counter_poly_mult = 0;
-        size_t counter_poly_mult_scalar = 0;
-        chrono::nanoseconds time_poly_add = chrono::nanoseconds::zero();
-        chrono::nanoseconds time_poly_sub = chrono::nanoseconds::zero();
-        chrono::nanoseconds time_poly_mult = chrono::nanoseconds::zero();
-        chrono::nanoseconds time_poly_mult_scalar = chrono::nanoseconds::zero();
+        atomic<size_t> counter_poly_add{ 0 };
+        atomic<size_t> counter_poly_sub{ 0 };
+        atomic<size_t> counter_poly_mult{ 0 };
+        atomic<size_t> counter_poly_mult_scalar{ 0 };
+        atomic<chrono::nanoseconds::rep> time_poly_add{ 0 };
+        atomic<chrono::nanoseconds::rep> time_poly_sub{ 0 };
+        atomic<chrono::nanoseconds::rep> time_poly_mult{ 0 };
+        atomic<chrono::nanoseconds::rep> time_poly_mult_scalar{ 0 };
 
         void modulo_poly_coeffs(ConstCoeffIter poly, std::size_t coeff_count, const Modulus &modulus, CoeffIter result)
         {
@@ -93,7 +94,7 @@ namespace seal
                 get<2>(I) = SEAL_COND_SELECT(sum >= modulus_value, sum - modulus_value, sum);
             });
 #endif
-            time_poly_add += chrono::steady_clock::now() - begin;
+            time_poly_add += (chrono::steady_clock::now() - begin).count();
         }
 
         void sub_poly_coeffmod(
@@ -141,7 +142,7 @@ namespace seal
                 get<2>(I) = temp_result + (modulus_value & static_cast<std::uint64_t>(-borrow));
             });
 #endif
-            time_poly_sub += chrono::steady_clock::now() - begin;
+            time_poly_sub += (chrono::steady_clock::now() - begin).count();
         }
 
         void add_poly_scalar_coeffmod(
@@ -237,7 +238,7 @@ namespace seal
                 get<1>(I) = multiply_uint_mod(x, scalar, modulus);
             });
 #endif
-            time_poly_mult_scalar += chrono::steady_clock::now() - begin;
+            time_poly_mult_scalar += (chrono::steady_clock::now() - begin).count();
         }
 
         void dyadic_product_coeffmod(
@@ -300,7 +301,65 @@ namespace seal
                 get<2>(I) = SEAL_COND_SELECT(tmp3 >= modulus_value, tmp3 - modulus_value, tmp3);
             });
 #endif
-            time_poly_mult += chrono::steady_clock::now() - begin;
+            time_poly_mult += (chrono::steady_clock::now() - begin).count();
+        }
+
+        void dyadic_product_accumulate(
+            ConstCoeffIter operand1, ConstCoeffIter operand2, size_t count, size_t stride, size_t coeff_count,
+            const Modulus &modulus, CoeffIter result)
+        {
+            counter_poly_mult += count;
+            auto begin = chrono::steady_clock::now();
+#ifdef SEAL_DEBUG
+            if (!operand1 && count > 0)
+            {
+                throw invalid_argument("operand1");
+            }
+            if (!operand2 && count > 0)
+            {
+                throw invalid_argument("operand2");
+            }
+            if (!result)
+            {
+                throw invalid_argument("result");
+            }
+            if (coeff_count == 0)
+            {
+                throw invalid_argument("coeff_count");
+            }
+            if (modulus.is_zero())
+            {
+                throw invalid_argument("modulus");
+            }
+#endif
+            // Each product is less than 2^(2 * bit_count); after a reduction the accumulator is less than
+            // 2^bit_count, so 2^(128 - 2 * bit_count) - 1 further products can be added without overflow.
+            int free_bits = 128 - 2 * modulus.bit_count();
+            size_t max_terms = free_bits >= numeric_limits<size_t>::digits ? numeric_limits<size_t>::max()
+                                                                           : (size_t(1) << free_bits) - 1;
+
+            const uint64_t *op1 = operand1.ptr();
+            const uint64_t *op2 = operand2.ptr();
+            for (size_t k = 0; k < coeff_count; k++)
+            {
+                unsigned long long acc[2]{ 0, 0 };
+                unsigned long long z[2];
+                size_t pending = 0;
+                for (size_t i = 0; i < count; i++)
+                {
+                    if (pending == max_terms)
+                    {
+                        acc[0] = barrett_reduce_128(acc, modulus);
+                        acc[1] = 0;
+                        pending = 0;
+                    }
+                    multiply_uint64(op1[i * stride + k], op2[i * stride + k], z);
+                    add_uint128(z, acc, acc);
+                    pending++;
+                }
+                result[k] = barrett_reduce_128(acc, modulus);
+            }
+            time_poly_mult += (chrono::steady_clock::now() - begin).count();
         }
 
         uint64_t poly_infty_norm_coeffmod(ConstCoeffIter operand, size_t coeff_count, const Modulus &modulus)
@@ -11,6 +11,8 @@
 #include "seal/util/polycore.h"
 #include "seal/util/uintarithsmallmod.h"
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <stdexcept>
 
@@ -19,14 +21,14 @@ namespace seal
     namespace util
     {
 
-        extern size_t counter_poly_add;
-        extern size_t counter_poly_sub;
-        extern size_t counter_poly_mult;
-        extern size_t counter_poly_mult_scalar;
-        extern std::chrono::nanoseconds time_poly_add;
-        extern std::chrono::nanoseconds time_poly_sub;
-        extern std::chrono::nanoseconds time_poly_mult;
-        extern std::chrono::nanoseconds time_poly_mult_scalar;
+        extern std::atomic<size_t> counter_poly_add;
+        extern std::atomic<size_t> counter_poly_sub;
+        extern std::atomic<size_t> counter_poly_mult;
+        extern std::atomic<size_t> counter_poly_mult_scalar;
+        extern std::atomic<std::chrono::nanoseconds::rep> time_poly_add;
+        extern std::atomic<std::chrono::nanoseconds::rep> time_poly_sub;
+        extern std::atomic<std::chrono::nanoseconds::rep> time_poly_mult;
+        extern std::atomic<std::chrono::nanoseconds::rep> time_poly_mult_scalar;
 
         void modulo_poly_coeffs(ConstCoeffIter poly, std::size_t coeff_count, const Modulus &modulus, CoeffIter result);
 
@@ -581,6 +583,56 @@ namespace seal
             });
         }
 
+        /**
+        Computes result[k] = sum_{i < count} operand1[i * stride + k] * operand2[i * stride + k] mod modulus,
+        i.e., the sum of count dyadic products. The products are accumulated as 128-bit values and only
+        reduced when the accumulator could overflow, and once at the end.
+        */
+        void dyadic_product_accumulate(
+            ConstCoeffIter operand1, ConstCoeffIter operand2, std::size_t count, std::size_t stride,
+            std::size_t coeff_count, const Modulus &modulus, CoeffIter result);
+
+        /**
+        Computes the inner product sum_{i < count} operand1[i] * operand2[i] of two arrays of count
+        polynomials in RNS representation, reducing every coefficient only once per modulus.
+        */
+        inline void dyadic_product_accumulate(
+            ConstPolyIter operand1, ConstPolyIter operand2, std::size_t count, ConstModulusIter modulus,
+            RNSIter result)
+        {
+#ifdef SEAL_DEBUG
+            if (!operand1 && count > 0)
+            {
+                throw std::invalid_argument("operand1");
+            }
+            if (!operand2 && count > 0)
+            {
+                throw std::invalid_argument("operand2");
+            }
+            if (!result)
+            {
+                throw std::invalid_argument("result");
+            }
+            if (!modulus)
+            {
+                throw std::invalid_argument("modulus");
+            }
+            if (operand1.coeff_modulus_size() != operand2.coeff_modulus_size() ||
+                operand1.poly_modulus_degree() != result.poly_modulus_degree() ||
+                operand2.poly_modulus_degree() != result.poly_modulus_degree())
+            {
+                throw std::invalid_argument("incompatible iterators");
+            }
+#endif
+            auto coeff_modulus_size = operand1.coeff_modulus_size();
+            auto poly_modulus_degree = result.poly_modulus_degree();
+            auto stride = coeff_modulus_size * poly_modulus_degree;
+            SEAL_ITERATE(iter(*operand1, *operand2, modulus, result), coeff_modulus_size, [&](auto I) {
+                dyadic_product_accumulate(
+                    get<0>(I), get<1>(I), count, stride, poly_modulus_degree, get<2>(I), get<3>(I));
+            });
+        }
+
         std::uint64_t poly_infty_norm_coeffmod(ConstCoeffIter operand, std::size_t coeff_count, const Modulus &modulus);
 
         void negacyclic_shift_poly_coeffmod(
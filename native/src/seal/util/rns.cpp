@@ -15,10 +15,10 @@ namespace seal
 {
     namespace util
     {
-        size_t counter_poly_compose = 0;
-        size_t counter_poly_decompose = 0;
-        std::chrono::nanoseconds time_poly_compose = chrono::nanoseconds::zero();
-        std::chrono::nanoseconds time_poly_decompose = chrono::nanoseconds::zero();
+        atomic<size_t> counter_poly_compose{ 0 };
+        atomic<size_t> counter_poly_decompose{ 0 };
+        atomic<chrono::nanoseconds::rep> time_poly_compose{ 0 };
+        atomic<chrono::nanoseconds::rep> time_poly_decompose{ 0 };
 
         RNSBase::RNSBase(const vector<Modulus> &rnsbase, MemoryPoolHandle pool)
             : pool_(move(pool)), size_(rnsbase.size())
@@ -323,7 +323,7 @@ namespace seal
                     });
                 });
             }
-            time_poly_decompose += chrono::steady_clock::now() - begin;
+            time_poly_decompose += (chrono::steady_clock::now() - begin).count();
         }
 
         void RNSBase::compose(uint64_t *value, MemoryPoolHandle pool) const
@@ -407,7 +407,7 @@ namespace seal
                         });
                 });
             }
-            time_poly_compose += chrono::steady_clock::now() - begin;
+            time_poly_compose += (chrono::steady_clock::now() - begin).count();
         }
 
         void BaseConverter::fast_convert(ConstCoeffIter in, CoeffIter out, MemoryPoolHandle pool) const
@@ -9,6 +9,8 @@
 #include "seal/util/ntt.h"
 #include "seal/util/pointer.h"
 #include "seal/util/uintarithsmallmod.h"
+#include <atomic>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
 #include <functional>
@@ -19,10 +21,10 @@ namespace seal
 {
     namespace util
     {
-        extern size_t counter_poly_compose;
-        extern size_t counter_poly_decompose;
-        extern std::chrono::nanoseconds time_poly_compose;
-        extern std::chrono::nanoseconds time_poly_decompose;
+        extern std::atomic<size_t> counter_poly_compose;
+        extern std::atomic<size_t> counter_poly_decompose;
+        extern std::atomic<std::chrono::nanoseconds::rep> time_poly_compose;
+        extern std::atomic<std::chrono::nanoseconds::rep> time_poly_decompose;
         
         class RNSBase
         {
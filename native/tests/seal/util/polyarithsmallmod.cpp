@@ -639,6 +639,84 @@ namespace sealtest
             }
         }
 
+        TEST(PolyArithSmallMod, DyadicProductAccumulate)
+        {
+            MemoryPool &pool = *global_variables::global_memory_pool;
+            {
+                SEAL_ALLOCATE_ZERO_GET_POLY_ITER(poly1, 2, 3, 2, pool);
+                SEAL_ALLOCATE_ZERO_GET_POLY_ITER(poly2, 2, 3, 2, pool);
+                SEAL_ALLOCATE_ZERO_GET_RNS_ITER(result, 3, 2, pool);
+                vector<Modulus> mod{ 13, 7 };
+
+                poly1[0][0][0] = 1;
+                poly1[0][0][1] = 2;
+                poly1[0][0][2] = 1;
+                poly1[0][1][0] = 2;
+                poly1[0][1][1] = 1;
+                poly1[0][1][2] = 2;
+                poly1[1][0][0] = 12;
+                poly1[1][0][1] = 0;
+                poly1[1][0][2] = 5;
+                poly1[1][1][0] = 6;
+                poly1[1][1][1] = 3;
+                poly1[1][1][2] = 1;
+
+                poly2[0][0][0] = 2;
+                poly2[0][0][1] = 3;
+                poly2[0][0][2] = 4;
+                poly2[0][1][0] = 2;
+                poly2[0][1][1] = 3;
+                poly2[0][1][2] = 4;
+                poly2[1][0][0] = 12;
+                poly2[1][0][1] = 7;
+                poly2[1][0][2] = 2;
+                poly2[1][1][0] = 6;
+                poly2[1][1][1] = 5;
+                poly2[1][1][2] = 0;
+
+                dyadic_product_accumulate(poly1, poly2, 2, mod, result);
+                ASSERT_EQ(3ULL, result[0][0]);
+                ASSERT_EQ(6ULL, result[0][1]);
+                ASSERT_EQ(1ULL, result[0][2]);
+                ASSERT_EQ(5ULL, result[1][0]);
+                ASSERT_EQ(4ULL, result[1][1]);
+                ASSERT_EQ(1ULL, result[1][2]);
+            }
+            {
+                // Enough maximal terms to force intermediate reductions for a 61-bit modulus
+                size_t count = 200;
+                SEAL_ALLOCATE_GET_POLY_ITER(poly1, count, 4, 2, pool);
+                SEAL_ALLOCATE_GET_POLY_ITER(poly2, count, 4, 2, pool);
+                SEAL_ALLOCATE_ZERO_GET_RNS_ITER(result, 4, 2, pool);
+                SEAL_ALLOCATE_ZERO_GET_RNS_ITER(expected, 4, 2, pool);
+                SEAL_ALLOCATE_GET_RNS_ITER(temp, 4, 2, pool);
+                vector<Modulus> mod{ (uint64_t(1) << 61) - 1, 0xFFFFFFFFFFFFC };
+
+                for (size_t i = 0; i < count; i++)
+                {
+                    for (size_t j = 0; j < 2; j++)
+                    {
+                        for (size_t k = 0; k < 4; k++)
+                        {
+                            poly1[i][j][k] = mod[j].value() - 1 - k * i;
+                            poly2[i][j][k] = mod[j].value() - 1 - k;
+                        }
+                    }
+                    dyadic_product_coeffmod(poly1[i], poly2[i], 2, mod, temp);
+                    add_poly_coeffmod(expected, temp, 2, mod, expected);
+                }
+
+                dyadic_product_accumulate(poly1, poly2, count, mod, result);
+                for (size_t j = 0; j < 2; j++)
+                {
+                    for (size_t k = 0; k < 4; k++)
+                    {
+                        ASSERT_EQ(expected[j][k], result[j][k]);
+                    }
+                }
+            }
+        }
+
         TEST(PolyArithSmallMod, PolyInftyNormCoeffMod)
         {
             MemoryPool &pool = *global_variables::global_memory_pool;
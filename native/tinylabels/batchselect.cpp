@@ -4,48 +4,207 @@ using namespace std;
 using namespace seal;
 using namespace seal::util;
 
-void sample_poly_normal(
-    shared_ptr<UniformRandomGenerator> prng, const EncryptionParameters &parms, uint64_t *destination,
-    double noise_standard_deviation, double noise_max_deviation)
+DiscreteGaussian::DiscreteGaussian(double standard_deviation, double max_deviation)
+{
+    // beyond tail_bound, the probabilities are below 2^-63 and would round to 0 anyway
+    double tail_bound = ceil(standard_deviation * sqrt(2 * 63 * log(2.0))) + 1;
+    size_t bound = static_cast<size_t>(max(0.0, floor(min(max_deviation, tail_bound))));
+
+    // the weights of |x| = k are exp(-k^2/(2 sigma^2)), counted twice for k > 0 (once per sign)
+    vector<long double> weights(bound + 1);
+    long double total = 0;
+    for (size_t k = 0; k <= bound; ++k) {
+        long double x = static_cast<long double>(k) / standard_deviation;
+        weights[k] = (k ? 2 : 1) * exp(-x * x / 2);
+        total += weights[k];
+    }
+
+    cdt_.resize(bound + 1);
+    long double sum = 0;
+    for (size_t k = 0; k <= bound; ++k) {
+        sum += weights[k];
+        cdt_[k] = static_cast<uint64_t>(min(sum / total, 1.0L) * static_cast<long double>(uint64_t(1) << 63));
+    }
+    cdt_[bound] = uint64_t(1) << 63;
+
+    // guide_[p] = |x| for the smallest u with the top guide_bits_ bits p (out of 63)
+    guide_bits_ = 1;
+    while (guide_bits_ < max_guide_bits && (size_t(1) << guide_bits_) < 4*cdt_.size()) ++guide_bits_;
+    guide_.resize(size_t(1) << guide_bits_);
+    size_t magnitude = 0;
+    for (size_t p = 0; p < guide_.size(); ++p) {
+        uint64_t u = static_cast<uint64_t>(p) << (63 - guide_bits_);
+        while (cdt_[magnitude] <= u) ++magnitude;
+        guide_[p] = static_cast<uint32_t>(magnitude);
+    }
+}
+
+void DiscreteGaussian::sample_poly(UniformRandomGenerator &prng, const EncryptionParameters &parms, uint64_t *destination) const
 {
     auto &coeff_modulus = parms.coeff_modulus();
     size_t coeff_modulus_size = coeff_modulus.size();
     size_t coeff_count = parms.poly_modulus_degree();
 
-    RandomToStandardAdapter engine(prng);
-    ClippedNormalDistribution dist(
-        0, noise_standard_deviation, noise_max_deviation);
+    // one word of randomness per coefficient, generated at once into the first residue array: the
+    // low bit is the sign, and the other 63 bits select |x| from the table
+    prng.generate(coeff_count * sizeof(uint64_t), reinterpret_cast<seal_byte *>(destination));
 
-    SEAL_ITERATE(iter(destination), coeff_count, [&](auto &I) {
-        int64_t noise = static_cast<int64_t>(dist(engine));
-        uint64_t flag = static_cast<uint64_t>(-static_cast<int64_t>(noise < 0));
-        SEAL_ITERATE(
-            iter(StrideIter<uint64_t *>(&I, coeff_count), coeff_modulus), coeff_modulus_size,
-            [&](auto J) { *get<0>(J) = static_cast<uint64_t>(noise) + (flag & get<1>(J).value()); });
-    });
+    const uint64_t *cdt = cdt_.data();
+    const uint32_t *guide = guide_.data();
+    int guide_shift = 63 - guide_bits_;
+    for (size_t k = 0; k < coeff_count; k++)
+    {
+        uint64_t random = destination[k], u = random >> 1;
+        // |x| is the number of table entries not above u; the guide table gives it for the top bits of
+        // u, which leaves at most a few entries to check (usually none)
+        uint64_t magnitude = guide[u >> guide_shift];
+        while (cdt[magnitude] <= u)
+        {
+            magnitude++;
+        }
+        bool negative = random & 1 && magnitude;
+        for (size_t j = 0; j < coeff_modulus_size; j++)
+        {
+            destination[j * coeff_count + k] = negative ? coeff_modulus[j].value() - magnitude : magnitude;
+        }
+    }
+}
+
+shared_ptr<UniformRandomGenerator> derive_prng(const prng_seed_type &seed, uint64_t stream)
+{
+    // the seed of stream i is BLAKE2b keyed with the parent seed, applied to i
+    prng_seed_type stream_seed;
+    if (blake2b(stream_seed.data(), prng_seed_byte_count, &stream, sizeof(stream), seed.data(), prng_seed_byte_count))
+    {
+        throw runtime_error("blake2b failed");
+    }
+    return UniformRandomGeneratorFactory::DefaultFactory()->create(stream_seed);
+}
+
+shared_ptr<UniformRandomGenerator> derive_prng(const UniformRandomGeneratorInfo &info, uint64_t stream)
+{
+    UniformRandomGeneratorInfo stream_info(info.type(), {});
+    if (blake2b(stream_info.seed().data(), prng_seed_byte_count, &stream, sizeof(stream), info.seed().data(), prng_seed_byte_count))
+    {
+        throw runtime_error("blake2b failed");
+    }
+    auto result = stream_info.make_prng();
+    if (!result)
+    {
+        throw logic_error("unsupported PRNG type");
+    }
+    return result;
+}
+
+// "TLPPSED2" in little endian; all coefficients are below 2^61, as SEAL's moduli have at most 61 bits
+constexpr uint64_t seed_marker = 0x3244455350504c54;
+// "TLPPSEED", the marker of the first version, whose polynomials were expanded with a different sampler
+constexpr uint64_t seed_marker_v1 = 0x4445455350504c54;
+constexpr const char *seed_v1_message = "the public parameters are stored as a seed of an older format, which this version expands differently; run setup again";
+
+void save_seed(FILE* f, const UniformRandomGeneratorInfo &info)
+{
+    vector<seal_byte> buffer(static_cast<size_t>(UniformRandomGeneratorInfo::SaveSize(compr_mode_type::none)));
+    size_t size = static_cast<size_t>(info.save(buffer.data(), buffer.size(), compr_mode_type::none));
+    fwrite(&seed_marker, 8, 1, f);
+    fwrite(&size, 8, 1, f);
+    fwrite(buffer.data(), 1, size, f);
+}
+
+bool read_seed(FILE* f, UniformRandomGeneratorInfo &info)
+{
+    uint64_t marker = 0;
+    if (fread(&marker, 8, 1, f) != 1 || marker != seed_marker) {
+        if (marker == seed_marker_v1) throw runtime_error(seed_v1_message);
+        fseek(f, -(long)sizeof(marker), SEEK_CUR);
+        return false;
+    }
+    size_t size = 0;
+    if (fread(&size, 8, 1, f) != 1 || size > (size_t)UniformRandomGeneratorInfo::SaveSize(compr_mode_type::none)) {
+        throw runtime_error("invalid seed");
+    }
+    vector<seal_byte> buffer(size);
+    if (fread(buffer.data(), 1, size, f) != size) {
+        throw runtime_error("invalid seed");
+    }
+    info.load(buffer.data(), size);
+    return true;
+}
+
+size_t read_seed(const uint8_t *in, size_t size, UniformRandomGeneratorInfo &info)
+{
+    uint64_t marker = 0;
+    if (size < 16 || (memcpy(&marker, in, 8), marker != seed_marker)) {
+        if (marker == seed_marker_v1) throw runtime_error(seed_v1_message);
+        return 0;
+    }
+    size_t length = 0;
+    memcpy(&length, in + 8, 8);
+    if (length > (size_t)UniformRandomGeneratorInfo::SaveSize(compr_mode_type::none) || length > size - 16) {
+        throw runtime_error("invalid seed");
+    }
+    info.load(reinterpret_cast<const seal_byte *>(in + 16), length);
+    return 16 + length;
+}
+
+// Returns the words words of file at offset (which is advanced past them).
+static uint64_t *map_words(MappedFile &file, size_t &offset, size_t words)
+{
+    if (offset % alignof(uint64_t) || file.size() < offset || (file.size() - offset) / 8 < words) {
+        throw runtime_error("mapped file is too short");
+    }
+    uint64_t *result = reinterpret_cast<uint64_t *>(file.data() + offset);
+    offset += words*8;
+    return result;
+}
+
+UniformRandomGeneratorInfo sample_seed(shared_ptr<UniformRandomGenerator> prng)
+{
+    // fall back to the default PRNG if prng is not one of the SEAL PRNGs, so that the seed can be expanded
+    prng_type type = prng->info().type();
+    if (type == prng_type::unknown) {
+        type = UniformRandomGeneratorFactory::DefaultFactory()->create({})->info().type();
+    }
+    UniformRandomGeneratorInfo info(type, {});
+    prng->generate(prng_seed_byte_count, reinterpret_cast<seal_byte *>(info.seed().data()));
+    return info;
 }
 
 void add_poly_error(
     size_t count,
     shared_ptr<UniformRandomGenerator> prng, const SEALContext::ContextData &context_data, uint64_t *destination,
-    double noise_standard_deviation, double noise_max_deviation)
+    double noise_standard_deviation, double noise_max_deviation, ThreadPool &pool)
+{
+    // Polynomial i is sampled from its own stream derived from a single seed, so the noise only
+    // depends on the state of prng and not on how the polynomials are split among threads.
+    prng_seed_type seed;
+    prng->generate(prng_seed_byte_count, reinterpret_cast<seal_byte *>(seed.data()));
+    add_poly_error(seed, 0, count, context_data, destination, noise_standard_deviation, noise_max_deviation, pool);
+}
+
+void add_poly_error(
+    const prng_seed_type &seed, size_t first, size_t count, const SEALContext::ContextData &context_data,
+    uint64_t *destination, double noise_standard_deviation, double noise_max_deviation, ThreadPool &pool)
 {
     auto &parms = context_data.parms();
     auto &coeff_modulus = parms.coeff_modulus();
     size_t coeff_modulus_size = coeff_modulus.size();
     size_t coeff_count = parms.poly_modulus_degree();
 
-    Pointer<uint64_t> temp = allocate_poly(poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
-
     PolyIter destination_iter(destination, coeff_count, coeff_modulus_size);
-    RNSIter temp_iter(temp.get(), coeff_count);
 
-    for (size_t i = 0; i < count; ++i) {
-        uint64_t *desti = destination+(coeff_modulus_size * coeff_count * i);
-        sample_poly_normal(prng, parms, temp.get(), noise_standard_deviation, noise_max_deviation);
-        ntt_negacyclic_harvey(temp_iter, coeff_modulus_size, context_data.small_ntt_tables());
-        add_poly_coeffmod(destination_iter[i], temp_iter, coeff_modulus_size, coeff_modulus, destination_iter[i]);
-    }
+    DiscreteGaussian gaussian(noise_standard_deviation, noise_max_deviation);
+
+    pool.parallel_for(count, [&](size_t begin, size_t end) {
+        Pointer<uint64_t> temp = allocate_poly(coeff_count, coeff_modulus_size, MemoryManager::GetPool());
+        RNSIter temp_iter(temp.get(), coeff_count);
+
+        for (size_t i = begin; i < end; ++i) {
+            gaussian.sample_poly(*derive_prng(seed, first + i), parms, temp.get());
+            ntt_negacyclic_harvey(temp_iter, coeff_modulus_size, context_data.small_ntt_tables());
+            add_poly_coeffmod(destination_iter[i], temp_iter, coeff_modulus_size, coeff_modulus, destination_iter[i]);
+        }
+    });
 }
 
 void sample_poly_uniform(
@@ -55,91 +214,76 @@ void sample_poly_uniform(
     auto &coeff_modulus = parms.coeff_modulus();
     size_t coeff_modulus_size = coeff_modulus.size();
     size_t coeff_count = parms.poly_modulus_degree();
-    size_t dest_byte_count = mul_safe(coeff_modulus_size, coeff_count, sizeof(uint64_t));
 
     constexpr uint64_t max_random = static_cast<uint64_t>(0xFFFFFFFFFFFFFFFFULL);
 
-    // Fill the destination buffer with fresh randomness
-    prng->generate(dest_byte_count, reinterpret_cast<seal_byte *>(destination));
+    /*
+    Every residue array is sampled as one block: coeff_count words go directly into destination,
+    followed by a spare block of about twice the expected number of rejections (and at least
+    spare_min words). The words below max_multiple are accepted, and moved to the front in order
+    by a branch-free compaction; the first accepted words of the spare block fill up the rest.
+    The accepted words are independent and uniform below max_multiple, so the distribution is the
+    same as with redrawing every rejected word. Apart from the (very unlikely) case that a spare
+    block runs out, in which another one is drawn, every residue array takes a fixed number of
+    words from prng.
+    */
+    constexpr size_t spare_min = 8;
+    vector<uint64_t> spare;
 
     for (size_t j = 0; j < coeff_modulus_size; j++)
     {
-        auto &modulus = coeff_modulus[j];
-        uint64_t max_multiple = max_random - barrett_reduce_64(max_random, modulus) - 1;
-        transform(destination, destination + coeff_count, destination, [&](uint64_t rand) {
-            // This ensures uniform distribution
-            while (rand >= max_multiple)
+        // a local copy, so that the compiler can keep the constants in registers
+        const Modulus modulus = coeff_modulus[j];
+        const uint64_t max_multiple = max_random - barrett_reduce_64(max_random, modulus) - 1;
+        double rejection_rate = static_cast<double>(max_random - max_multiple) / 18446744073709551616.0;
+        size_t spare_count = spare_min + 2 * static_cast<size_t>(ceil(rejection_rate * static_cast<double>(coeff_count)));
+        spare.resize(spare_count);
+
+        prng->generate(mul_safe(coeff_count, sizeof(uint64_t)), reinterpret_cast<seal_byte *>(destination));
+        prng->generate(mul_safe(spare_count, sizeof(uint64_t)), reinterpret_cast<seal_byte *>(spare.data()));
+
+        // in place, as the k-th word is moved to position accepted <= k
+        size_t accepted = 0;
+        for (size_t k = 0; k < coeff_count; k++)
+        {
+            uint64_t value = destination[k];
+            destination[accepted] = value;
+            accepted += value < max_multiple;
+        }
+        while (accepted < coeff_count)
+        {
+            for (size_t k = 0; k < spare_count && accepted < coeff_count; k++)
             {
-                prng->generate(sizeof(uint64_t), reinterpret_cast<seal_byte *>(&rand));
+                destination[accepted] = spare[k];
+                accepted += spare[k] < max_multiple;
             }
-            return barrett_reduce_64(rand, modulus);
-        });
-        destination += coeff_count;
-    }
-}
-
-// Destination needs to be a poly array of size len_n*len_m.
-// The elements are ordered as a[1]*b[1],...,a[1]*b[len_b],a[2]*b[1],... (i.e., the matrix in a row-wise order)
-void outer_product(PolyIter a, size_t len_a, PolyIter b, size_t len_b, PolyIter destination, const vector<Modulus> &coeff_modulus) {
-    SEAL_ITERATE(iter(a, seq_iter(0)), len_a, [&](const tuple<RNSIter,uint64_t> &I) {
-        SEAL_ITERATE(iter(b, destination + get<1>(I)*len_b), len_b, [&](const tuple<RNSIter,RNSIter> &J) {
-             dyadic_product_coeffmod(get<0>(I), get<0>(J), coeff_modulus.size(), coeff_modulus, get<1>(J));
-        });
-    });
-}
-
-void vector_constant_product(PolyIter a, size_t len_a, RNSIter b, PolyIter destination, const vector<Modulus> &coeff_modulus) {
-    auto deg = a.poly_modulus_degree();
-    SEAL_ITERATE(iter(a, destination), len_a, [&](const tuple<RNSIter,RNSIter> &I) {
-        dyadic_product_coeffmod(get<0>(I), b, coeff_modulus.size(), coeff_modulus, get<1>(I));
-    });
-}
-
-void inner_product(PolyIter a, PolyIter b, size_t len, RNSIter destination, const vector<Modulus> &coeff_modulus) {
-    auto temp(allocate_zero_poly(destination.poly_modulus_degree(), coeff_modulus.size(), MemoryPoolHandle::Global()));
-    RNSIter tempIter(temp.get(), destination.poly_modulus_degree());
-    set_zero_poly(destination.poly_modulus_degree(), coeff_modulus.size(), destination);
-    SEAL_ITERATE(iter(a, b), len, [&](const tuple<RNSIter,RNSIter> &I) {
-        dyadic_product_coeffmod(get<0>(I), get<1>(I), coeff_modulus.size(), coeff_modulus, tempIter);
-        add_poly_coeffmod(tempIter, destination, coeff_modulus.size(), coeff_modulus, destination);
-    });
-}
-
-void multiply_g(RNSIter a, PolyIter destination, const SEALContext::ContextData &context_data) {
-    const EncryptionParameters &parms = context_data.parms();
-    size_t poly_modulus_degree = parms.poly_modulus_degree();
-    const vector<Modulus> &coeff_modulus = parms.coeff_modulus();
-    size_t coeff_modulus_size = coeff_modulus.size();
+            if (accepted < coeff_count)
+            {
+                prng->generate(mul_safe(spare_count, sizeof(uint64_t)), reinterpret_cast<seal_byte *>(spare.data()));
+            }
+        }
 
-    set_poly(a, poly_modulus_degree, coeff_modulus_size, destination);
-    for (size_t i = 1; i < m; ++i) {
-        multiply_poly_scalar_coeffmod(destination[i-1], coeff_modulus_size, g, coeff_modulus, destination[i]);
+        for (size_t k = 0; k < coeff_count; k++)
+        {
+            destination[k] = barrett_reduce_64(destination[k], modulus);
+        }
+        destination += coeff_count;
     }
 }
 
-void decompose_g(RNSIter y, PolyIter destination, const SEALContext::ContextData &context_data) {
-    const EncryptionParameters &parms = context_data.parms();
-    size_t poly_modulus_degree = parms.poly_modulus_degree();
-    const vector<Modulus> &coeff_modulus = parms.coeff_modulus();
-    size_t coeff_modulus_size = coeff_modulus.size();
-    auto ntt_tables = context_data.small_ntt_tables();
-    
-    Pointer<uint64_t> y_composed = allocate_poly(poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
-    RNSIter y_composed_iter(y_composed.get(), poly_modulus_degree);
-
-    set_poly(*y, poly_modulus_degree, coeff_modulus_size, y_composed.get());
-    inverse_ntt_negacyclic_harvey(y_composed_iter, coeff_modulus_size, ntt_tables); // inverse NTT
-    context_data.rns_tool()->base_q()->compose_array(y_composed.get(), poly_modulus_degree, MemoryManager::GetPool()); // combine the two mod values into a single integers
-
-    SEAL_ITERATE(destination, m, [&](const RNSIter &I) {
-        // take mod g, and divide by g:
-        SEAL_ITERATE(iter(StrideIter<uint64_t*>(y_composed, coeff_modulus_size), StrideIter<uint64_t*>((*I).ptr(), coeff_modulus_size)), poly_modulus_degree, [&](const tuple<uint64_t*,uint64_t*> &J) {
-            SEAL_DIVIDE_UINT128_UINT64(get<0>(J), g, get<1>(J));
-            swap(*(get<0>(J)), *(get<1>(J)));
-            swap(*(get<0>(J)+1), *(get<1>(J)+1));
-        });
-        context_data.rns_tool()->base_q()->decompose_array((*I).ptr(), poly_modulus_degree, MemoryManager::GetPool()); // back into mod form
-        ntt_negacyclic_harvey(I, coeff_modulus_size, ntt_tables); // forward NTT
+void sample_poly_array_uniform(
+    size_t count, shared_ptr<UniformRandomGenerator> prng, const EncryptionParameters &parms, uint64_t *destination,
+    ThreadPool &pool)
+{
+    // as in add_poly_error, polynomial i is sampled from its own stream derived from a single seed
+    prng_seed_type seed;
+    prng->generate(prng_seed_byte_count, reinterpret_cast<seal_byte *>(seed.data()));
+
+    size_t poly_size = parms.poly_modulus_degree() * parms.coeff_modulus().size();
+    pool.parallel_for(count, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            sample_poly_uniform(derive_prng(seed, i), parms, destination + i*poly_size);
+        }
     });
 }
 
@@ -152,14 +296,14 @@ string time_str(chrono::nanoseconds time) {
 void print_statistics() {
     cout << "===================\n";
     cout << "Number of operations (and total time spent on them) for each type of operations on ring elements\n";
-    cout << "# Add's = " << counter_poly_add << " (" << time_str(time_poly_add) << ")\n";
-    cout << "# Sub's = " << counter_poly_sub << " (" << time_str(time_poly_sub) << ")\n";
-    cout << "# Mult's = " << counter_poly_mult << " (" << time_str(time_poly_mult) << ")\n";
-    cout << "# Scalar mult's = " << counter_poly_mult_scalar << " (" << time_str(time_poly_mult_scalar) << ")\n";
-    cout << "# Forward NTT's = " << counter_ntt_forward << " (" << time_str(time_ntt_forward) << ")\n";
-    cout << "# Inverse NTT's = " << counter_ntt_inverse << " (" << time_str(time_ntt_inverse) << ")\n";
-    cout << "# Compose = " << counter_poly_compose << " (" << time_str(time_poly_compose) << ")\n";
-    cout << "# Decompose = " << counter_poly_decompose << " (" << time_str(time_poly_decompose) << ")\n";
+    cout << "# Add's = " << counter_poly_add << " (" << time_str(chrono::nanoseconds(time_poly_add)) << ")\n";
+    cout << "# Sub's = " << counter_poly_sub << " (" << time_str(chrono::nanoseconds(time_poly_sub)) << ")\n";
+    cout << "# Mult's = " << counter_poly_mult << " (" << time_str(chrono::nanoseconds(time_poly_mult)) << ")\n";
+    cout << "# Scalar mult's = " << counter_poly_mult_scalar << " (" << time_str(chrono::nanoseconds(time_poly_mult_scalar)) << ")\n";
+    cout << "# Forward NTT's = " << counter_ntt_forward << " (" << time_str(chrono::nanoseconds(time_ntt_forward)) << ")\n";
+    cout << "# Inverse NTT's = " << counter_ntt_inverse << " (" << time_str(chrono::nanoseconds(time_ntt_inverse)) << ")\n";
+    cout << "# Compose = " << counter_poly_compose << " (" << time_str(chrono::nanoseconds(time_poly_compose)) << ")\n";
+    cout << "# Decompose = " << counter_poly_decompose << " (" << time_str(chrono::nanoseconds(time_poly_decompose)) << ")\n";
 }
 
 
@@ -169,51 +313,106 @@ void print_statistics() {
 Generates the public parameters.
 */
 void LHE::setup() {
-    const EncryptionParameters &parms = context_data_.parms();
-    size_t poly_modulus_degree = parms.poly_modulus_degree();
-    size_t coeff_modulus_size = parms.coeff_modulus().size();
+    // a is only expanded block by block when it is needed (see a_block)
+    a_info_ = sample_seed(prng);
+    data_a_.release();
+}
 
-    data_a_ = allocate_poly_array(w, poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
-    SEAL_ITERATE(PolyIter(data_a_.get(), poly_modulus_degree, coeff_modulus_size), w, [&](const RNSIter &I) {
-        sample_poly_uniform(prng, parms, I);
-    });
+void LHE::save_pp(FILE* f, bool seeded) {
+    if (seeded && !data_a_) {
+        save_seed(f, a_info_);
+        return;
+    }
+    Pointer<uint64_t> temp = allocate_poly(params_.poly_modulus_degree, coeff_modulus_size(), MemoryManager::GetPool());
+    for (size_t i = 0; i < params_.w; ++i) {
+        fwrite(a_block(i, temp.get()), 8, poly_size(), f);
+    }
+}
+
+void LHE::read_pp(FILE* f) {
+    if (read_seed(f, a_info_)) {
+        data_a_.release();
+        return;
+    }
+    data_a_ = allocate_poly_array(params_.w, params_.poly_modulus_degree, coeff_modulus_size(), MemoryManager::GetPool());
+    fread(data_a_.get(), 8, params_.w*poly_size(), f);
+}
+
+void LHE::map_pp(shared_ptr<MappedFile> file, size_t &offset) {
+    if (size_t seed_size = read_seed(file->data() + offset, file->size() - offset, a_info_)) {
+        offset += seed_size;
+        data_a_.release();
+        return;
+    }
+    data_a_ = Pointer<uint64_t>::Aliasing(map_words(*file, offset, params_.w*poly_size()));
+    pp_file_ = file;
+}
+
+void LHE::map_ct1(shared_ptr<MappedFile> file, size_t &offset) {
+    size_t count = params_.w*params_.m;
+    if (map_packed(*file, offset, data_ct1_, count)) {
+        ct1_file_.reset();
+        return;
+    }
+    size_t words = count*poly_size();
+    data_ct1_ = Pointer<uint64_t>::Aliasing(map_words(*file, offset, words));
+    ct1_file_ = file;
+    // LHE::dec reads ct1 once, front to back, and is the first to use it
+    file->sequential(data_ct1_.get(), words*8);
+    file->will_need(data_ct1_.get(), words*8);
+}
+
+RNSIter LHE::a_block(size_t i, uint64_t *temp) const {
+    if (data_a_) {
+        return RNSIter(data_a_.get() + i*poly_size(), params_.poly_modulus_degree);
+    }
     // no need to convert a into NTT, as we may assume that it was already sampled in NTT form
+    sample_poly_uniform(derive_prng(a_info_, i), context_data_.parms(), temp);
+    return RNSIter(temp, params_.poly_modulus_degree);
 }
 
 /**
 Takes m1, and generates s1 and ct1 accordingly.
 */
 void LHE::enc1(Pointer<uint64_t> &m1) {
+    enc1(m1, prng);
+}
+
+void LHE::enc1(Pointer<uint64_t> &m1, shared_ptr<UniformRandomGenerator> random) {
     const EncryptionParameters &parms = context_data_.parms();
     size_t poly_modulus_degree = parms.poly_modulus_degree();
     const vector<Modulus> &coeff_modulus = parms.coeff_modulus();
     size_t coeff_modulus_size = coeff_modulus.size();
+    size_t w = params_.w, m = params_.m;
 
     data_s1_ = allocate_poly_array(m, poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
     data_ct1_ = allocate_poly_array(w*m, poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
-    Pointer<uint64_t> temp = allocate_poly_array(m, poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
 
-    PolyIter a_iter(data_a_.get(), poly_modulus_degree, coeff_modulus_size);
     PolyIter s1_iter(data_s1_.get(), poly_modulus_degree, coeff_modulus_size);
     PolyIter ct1_iter(data_ct1_.get(), poly_modulus_degree, coeff_modulus_size);
     PolyIter m1_iter(m1.get(), poly_modulus_degree, coeff_modulus_size);
-    PolyIter temp_iter(temp.get(), poly_modulus_degree, coeff_modulus_size);
 
-    SEAL_ITERATE(s1_iter, m, [&](const RNSIter &I) {
-        sample_poly_uniform(prng, parms, I);
-    });
+    sample_poly_array_uniform(m, random, parms, data_s1_.get(), *pool);
     // as for a, we just interprete s as polynomials in NTT form
-
-    outer_product(a_iter, w, s1_iter, m, ct1_iter, coeff_modulus);
-
-    for (size_t i = 0; i < w; ++i) {
-        multiply_g(m1_iter[i], temp_iter, context_data_);
-        add_poly_coeffmod(ct1_iter + (i*m), temp_iter, m, coeff_modulus, ct1_iter + (i*m));
-    }
+    PreparedPolys s1_prepared(s1_iter, m, coeff_modulus);
+
+    // the w blocks ct1[i] = a[i]*s1 + g*m1[i] are independent
+    pool->parallel_for(w, [&](size_t begin, size_t end) {
+        Pointer<uint64_t> temp = allocate_poly_array(m, poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
+        Pointer<uint64_t> a_temp = allocate_poly(poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
+        PolyIter temp_iter(temp.get(), poly_modulus_degree, coeff_modulus_size);
+
+        for (size_t i = begin; i < end; ++i) {
+            PolyIter a_i(a_block(i, a_temp.get()), poly_modulus_degree, coeff_modulus_size);
+            kernels_.outer_product(a_i, 1, s1_prepared, ct1_iter + (i*m), coeff_modulus);
+            kernels_.multiply_g(m1_iter[i], temp_iter, params_, context_data_);
+            add_poly_coeffmod(ct1_iter + (i*m), temp_iter, m, coeff_modulus, ct1_iter + (i*m));
+        }
+    });
 
     auto begin = chrono::steady_clock::now();
-    add_poly_error(w*m, prng, context_data_, data_ct1_.get(), noise_small_standard_deviation, noise_small_max_deviation);
-    cerr << "Time used for generating noise: " << time_str(chrono::steady_clock::now() - begin) << "\n";
+    add_poly_error(w*m, random, context_data_, data_ct1_.get(), noise_small_standard_deviation, noise_small_max_deviation, *pool);
+    cerr << "Time used for generating noise: " + time_str(chrono::steady_clock::now() - begin) + "\n";
 }
 
 /**
@@ -224,23 +423,32 @@ void LHE::enc2(Pointer<uint64_t> &m2) {
     size_t poly_modulus_degree = parms.poly_modulus_degree();
     const vector<Modulus> &coeff_modulus = parms.coeff_modulus();
     size_t coeff_modulus_size = coeff_modulus.size();
+    size_t w = params_.w;
 
     data_s2_ = allocate_poly(poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
     data_ct2_ = allocate_poly_array(w, poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
 
-    PolyIter a_iter(data_a_.get(), poly_modulus_degree, coeff_modulus_size);
     RNSIter s2_iter(data_s2_.get(), poly_modulus_degree);
     PolyIter ct2_iter(data_ct2_.get(), poly_modulus_degree, coeff_modulus_size);
     PolyIter m2_iter(m2.get(), poly_modulus_degree, coeff_modulus_size);
 
     sample_poly_uniform(prng, parms, s2_iter);
+    PreparedPolys s2_prepared(PolyIter(data_s2_.get(), poly_modulus_degree, coeff_modulus_size), 1, coeff_modulus);
 
-    vector_constant_product(a_iter, w, s2_iter, ct2_iter, coeff_modulus);
-    add_poly_coeffmod(ct2_iter, m2_iter, w, coeff_modulus, ct2_iter);
+    pool->parallel_for(w, [&](size_t begin, size_t end) {
+        Pointer<uint64_t> a_temp = allocate_poly(poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
+
+        for (size_t i = begin; i < end; ++i) {
+            // ct2[i] = a[i]*s2 + m2[i]
+            PolyIter a_i(a_block(i, a_temp.get()), poly_modulus_degree, coeff_modulus_size);
+            kernels_.outer_product(a_i, 1, s2_prepared, ct2_iter + i, coeff_modulus);
+            add_poly_coeffmod(ct2_iter[i], m2_iter[i], coeff_modulus_size, coeff_modulus, ct2_iter[i]);
+        }
+    });
 
     auto begin = chrono::steady_clock::now();
-    add_poly_error(w, prng, context_data_, data_ct2_.get(), noise_large_standard_deviation, noise_large_max_deviation);
-    cerr << "Time used for generating noise: " << time_str(chrono::steady_clock::now() - begin) << "\n";
+    add_poly_error(w, prng, context_data_, data_ct2_.get(), noise_large_standard_deviation, noise_large_max_deviation, *pool);
+    cerr << "Time used for generating noise: " + time_str(chrono::steady_clock::now() - begin) + "\n";
 }
 
 /**
@@ -251,6 +459,7 @@ void LHE::keygen(Pointer<uint64_t> &y) {
     size_t poly_modulus_degree = parms.poly_modulus_degree();
     const vector<Modulus> &coeff_modulus = parms.coeff_modulus();
     size_t coeff_modulus_size = coeff_modulus.size();
+    size_t m = params_.m;
 
     data_sk_ = allocate_poly(poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
     Pointer<uint64_t> y_decomposed = allocate_poly_array(m, poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
@@ -258,11 +467,10 @@ void LHE::keygen(Pointer<uint64_t> &y) {
 
     PolyIter s1_iter(data_s1_.get(), poly_modulus_degree, coeff_modulus_size);
     RNSIter sk_iter(data_sk_.get(), poly_modulus_degree);
-    RNSIter y_iter(y.get(), poly_modulus_degree);
     PolyIter y_decomposed_iter(y_decomposed.get(), poly_modulus_degree, coeff_modulus_size);
     RNSIter temp_iter(temp.get(), poly_modulus_degree);
 
-    decompose_g(y_iter, y_decomposed_iter, context_data_);
+    kernels_.decompose_g(PolyIter(y.get(), poly_modulus_degree, coeff_modulus_size), 1, y_decomposed_iter, params_, context_data_);
 
     // sk <- s2
     set_poly(data_s2_.get(), poly_modulus_degree, coeff_modulus_size, data_sk_.get());
@@ -277,38 +485,77 @@ void LHE::keygen(Pointer<uint64_t> &y) {
 Takes y, and computes mres from ct1, ct2, and y.
 */
 Pointer<uint64_t>& LHE::dec(Pointer<uint64_t> &y) {
-    const EncryptionParameters &parms = context_data_.parms();
-    size_t poly_modulus_degree = parms.poly_modulus_degree();
-    const vector<Modulus> &coeff_modulus = parms.coeff_modulus();
-    size_t coeff_modulus_size = coeff_modulus.size();
+    data_mres_ = allocate_poly_array(params_.w, params_.poly_modulus_degree, coeff_modulus_size(), MemoryManager::GetPool());
+    dec_many({ y.get() }, { data_sk_.get() }, { data_mres_.get() });
+    return data_mres_;
+}
 
-    data_mres_ = allocate_poly_array(w, poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
-    Pointer<uint64_t> y_decomposed = allocate_poly_array(m, poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
-    Pointer<uint64_t> temp = allocate_poly_array(w, poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
+void LHE::dec_many(const vector<uint64_t *> &ys, const vector<uint64_t *> &sks, const vector<uint64_t *> &results) {
+    Pointer<uint64_t> ys_decomposed = decompose_ys(ys);
+    dec_blocks(ys_decomposed.get(), prepare_sks(sks), 0, params_.w, results);
+}
 
-    PolyIter a_iter(data_a_.get(), poly_modulus_degree, coeff_modulus_size);
-    RNSIter sk_iter(data_sk_.get(), poly_modulus_degree);
-    PolyIter ct1_iter(data_ct1_.get(), poly_modulus_degree, coeff_modulus_size);
-    PolyIter ct2_iter(data_ct2_.get(), poly_modulus_degree, coeff_modulus_size);
-    PolyIter mres_iter(data_mres_.get(), poly_modulus_degree, coeff_modulus_size);
-    RNSIter y_iter(y.get(), poly_modulus_degree);
-    PolyIter y_decomposed_iter(y_decomposed.get(), poly_modulus_degree, coeff_modulus_size);
-    PolyIter temp_iter(temp.get(), poly_modulus_degree, coeff_modulus_size);
+Pointer<uint64_t> LHE::decompose_ys(const vector<uint64_t *> &ys) {
+    size_t poly_modulus_degree = params_.poly_modulus_degree;
+    size_t m = params_.m;
 
-    decompose_g(y_iter, y_decomposed_iter, context_data_);
+    Pointer<uint64_t> result = allocate_poly_array(ys.size()*m, poly_modulus_degree, coeff_modulus_size(), MemoryManager::GetPool());
+    PolyIter result_iter(result.get(), poly_modulus_degree, coeff_modulus_size());
+    for (size_t q = 0; q < ys.size(); ++q) {
+        kernels_.decompose_g(PolyIter(ys[q], poly_modulus_degree, coeff_modulus_size()), 1, result_iter + q*m, params_, context_data_);
+    }
+    return result;
+}
 
-    // mres <- ct1 * y
-    for (size_t i = 0; i < w; ++i) {
-        inner_product(ct1_iter + i*m, y_decomposed_iter, m, mres_iter[i], coeff_modulus);
+// every sk is multiplied with all w blocks of a
+vector<PreparedPolys> LHE::prepare_sks(const vector<uint64_t *> &sks) {
+    vector<PreparedPolys> result;
+    for (uint64_t *sk : sks) {
+        result.emplace_back(PolyIter(sk, params_.poly_modulus_degree, coeff_modulus_size()), 1, context_data_.parms().coeff_modulus());
     }
-    // mres += ct2
-    add_poly_coeffmod(mres_iter, ct2_iter, w, coeff_modulus, mres_iter);
+    return result;
+}
 
-    // mres -= a*sk
-    vector_constant_product(a_iter, w, sk_iter, temp_iter, coeff_modulus);
-    sub_poly_coeffmod(mres_iter, temp_iter, w, coeff_modulus, mres_iter);
+void LHE::release_blocks(size_t first, size_t count) {
+    if (!ct1_file_) return;
+    size_t block_words = params_.m*poly_size();
+    ct1_file_->dont_need(data_ct1_.get() + first*block_words, count*block_words*8);
+}
 
-    return data_mres_;
+void LHE::dec_blocks(const uint64_t *ys_decomposed, const vector<PreparedPolys> &sks, size_t first, size_t count, const vector<uint64_t *> &results) {
+    const EncryptionParameters &parms = context_data_.parms();
+    size_t poly_modulus_degree = parms.poly_modulus_degree();
+    const vector<Modulus> &coeff_modulus = parms.coeff_modulus();
+    size_t coeff_modulus_size = coeff_modulus.size();
+    size_t m = params_.m;
+    size_t queries = sks.size();
+
+    PolyIter ct1_iter(data_ct1_.get(), poly_modulus_degree, coeff_modulus_size);
+    PolyIter ct2_iter(data_ct2_.get(), poly_modulus_degree, coeff_modulus_size);
+    PolyIter y_decomposed_iter(const_cast<uint64_t *>(ys_decomposed), poly_modulus_degree, coeff_modulus_size);
+
+    // every block of mres is computed independently, with two scratch polynomials per thread;
+    // a is never held in memory as a whole if it was given as a seed, and each block of a and ct1
+    // is used for all queries right after another
+    pool->parallel_for(count, [&](size_t begin, size_t end) {
+        Pointer<uint64_t> a_temp = allocate_poly(poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
+        Pointer<uint64_t> temp = allocate_poly(poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
+        PolyIter temp_iter(temp.get(), poly_modulus_degree, coeff_modulus_size);
+
+        for (size_t i = first + begin; i < first + end; ++i) {
+            PolyIter a_iter(a_block(i, a_temp.get()), poly_modulus_degree, coeff_modulus_size);
+            for (size_t q = 0; q < queries; ++q) {
+                RNSIter mres_iter = PolyIter(results[q], poly_modulus_degree, coeff_modulus_size)[i - first];
+                // mres <- ct1 * y
+                kernels_.inner_product(ct1_iter + i*m, y_decomposed_iter + q*m, m, mres_iter, coeff_modulus);
+                // mres += ct2
+                add_poly_coeffmod(mres_iter, ct2_iter[i], coeff_modulus_size, coeff_modulus, mres_iter);
+                // mres -= a*sk
+                kernels_.outer_product(a_iter, 1, sks[q], temp_iter, coeff_modulus);
+                sub_poly_coeffmod(mres_iter, *temp_iter, coeff_modulus_size, coeff_modulus, mres_iter);
+            }
+        }
+    });
 }
 
 
@@ -319,58 +566,181 @@ Pointer<uint64_t>& LHE::dec(Pointer<uint64_t> &y) {
 Generates the public parameters.
 */
 void Lenc::setup() {
+    b_info_ = sample_seed(prng);
+    expand_b();
+}
+
+void Lenc::expand_b() {
     const EncryptionParameters &parms = context_data_.parms();
     size_t poly_modulus_degree = parms.poly_modulus_degree();
     size_t coeff_modulus_size = parms.coeff_modulus().size();
+    size_t m = params_.m;
 
     data_b_ = allocate_poly_array(2*m, poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
-    SEAL_ITERATE(PolyIter(data_b_.get(), poly_modulus_degree, coeff_modulus_size), 2*m, [&](const RNSIter &I) {
-        sample_poly_uniform(prng, parms, I);
+    SEAL_ITERATE(iter(PolyIter(data_b_.get(), poly_modulus_degree, coeff_modulus_size), seq_iter(0)), 2*m, [&](const tuple<RNSIter,uint64_t> &I) {
+        sample_poly_uniform(derive_prng(b_info_, get<1>(I)), parms, get<0>(I));
     });
-    // no need to convert a into NTT, as we may assume that it was already sampled in NTT form
+    // no need to convert b into NTT, as we may assume that it was already sampled in NTT form
+}
+
+void Lenc::save_pp(FILE* f, bool seeded) {
+    // if b was read in full, there is no seed to save
+    if (seeded && b_info_.type() != prng_type::unknown) {
+        save_seed(f, b_info_);
+    } else {
+        fwrite(data_b_.get(), 8, 2*params_.m*poly_size(), f);
+    }
+}
+
+void Lenc::map_pp(shared_ptr<MappedFile> file, size_t &offset) {
+    if (size_t seed_size = read_seed(file->data() + offset, file->size() - offset, b_info_)) {
+        offset += seed_size;
+        expand_b();
+        return;
+    }
+    // b is small, so it is copied (the offset may not be aligned if a was stored as a seed)
+    size_t words = 2*params_.m*poly_size();
+    if (file->size() < offset || (file->size() - offset) / 8 < words) {
+        throw runtime_error("mapped file is too short");
+    }
+    b_info_ = UniformRandomGeneratorInfo();
+    data_b_ = allocate_poly_array(2*params_.m, params_.poly_modulus_degree, coeff_modulus_size(), MemoryManager::GetPool());
+    memcpy(data_b_.get(), file->data() + offset, words*8);
+    offset += words*8;
+}
+
+void Lenc::map_ct1(shared_ptr<MappedFile> file, size_t &offset) {
+    if (map_packed(*file, offset, data_ct_, ct_poly_count())) {
+        ct_file_.reset();
+        return;
+    }
+    size_t words = ct_poly_count()*poly_size();
+    data_ct_ = Pointer<uint64_t>::Aliasing(map_words(*file, offset, words));
+    ct_file_ = file;
+    // Lenc::eval reads every block once; each thread walks through its range of leaves, i.e.,
+    // through one increasing stream (leaf-major layout) or l of them (level-major layout)
+    file->sequential(data_ct_.get(), words*8);
+}
+
+void Lenc::map_digest(shared_ptr<MappedFile> file, size_t &offset) {
+    data_digest_ = Pointer<uint64_t>::Aliasing(map_words(*file, offset, poly_size()));
+    data_tree_ = Pointer<uint64_t>::Aliasing(map_words(*file, offset, tree_poly_count()*poly_size()));
+    digest_file_ = file;
+    tree_rebuilt_ = true;
+    eval_base_.clear();
+}
+
+void Lenc::read_pp(FILE* f) {
+    if (read_seed(f, b_info_)) {
+        expand_b();
+        return;
+    }
+    b_info_ = UniformRandomGeneratorInfo();
+    data_b_ = allocate_poly_array(2*params_.m, params_.poly_modulus_degree, coeff_modulus_size(), MemoryManager::GetPool());
+    fread(data_b_.get(), 8, 2*params_.m*poly_size(), f);
 }
 
 /**
 Takes s, and generates r and ct accordingly.
 */
 Pointer<uint64_t>& Lenc::enc(Pointer<uint64_t> &s) {
+    sample_r();
+    enc_ct(s, prng);
+    return data_r_;
+}
+
+Pointer<uint64_t>& Lenc::sample_r() {
+    const EncryptionParameters &parms = context_data_.parms();
+    size_t w = params_.w, l = params_.l();
+
+    data_r_ = allocate_poly_array(l*w, parms.poly_modulus_degree(), parms.coeff_modulus().size(), MemoryManager::GetPool());
+
+    // r is uniform, and (like a, b, and s) taken to be in NTT form
+    sample_poly_array_uniform(l*w, prng, parms, data_r_.get(), *pool);
+    return data_r_;
+}
+
+void Lenc::enc_ct(Pointer<uint64_t> &s, shared_ptr<UniformRandomGenerator> random) {
     const EncryptionParameters &parms = context_data_.parms();
     size_t poly_modulus_degree = parms.poly_modulus_degree();
     const vector<Modulus> &coeff_modulus = parms.coeff_modulus();
     size_t coeff_modulus_size = coeff_modulus.size();
+    size_t w = params_.w, l = params_.l(), m = params_.m;
 
-    data_r_ = allocate_poly_array(l*w, poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
     data_ct_ = allocate_poly_array(l*w*2*m, poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
-    Pointer<uint64_t> temp = allocate_poly_array(m, poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
 
-    PolyIter b_iter(data_b_.get(), poly_modulus_degree, coeff_modulus_size);
-    PolyIter r_iter(data_r_.get(), poly_modulus_degree, coeff_modulus_size);
-    PolyIter s_iter(s.get(), poly_modulus_degree, coeff_modulus_size);
-    PolyIter ct_iter(data_ct_.get(), poly_modulus_degree, coeff_modulus_size);
-    PolyIter temp_iter(temp.get(), poly_modulus_degree, coeff_modulus_size);
+    // b is multiplied with all l*w polynomials of r
+    PreparedPolys b_prepared(PolyIter(data_b_.get(), poly_modulus_degree, coeff_modulus_size), 2*m, coeff_modulus);
+    enc_blocks(0, l*w, b_prepared, s.get(), data_ct_.get());
 
-    for (size_t i = 0; i < l; ++i) {
-        PolyIter cti_iter = ct_iter + i*2*m*w;
-        outer_product(r_iter + i*w, w, b_iter, 2*m, cti_iter, coeff_modulus);
+    auto begin = chrono::steady_clock::now();
+    add_poly_error(l*w*2*m, random, context_data_, data_ct_.get(), noise_small_standard_deviation, noise_small_max_deviation, *pool);
+    cerr << "Time used for generating noise: " + time_str(chrono::steady_clock::now() - begin) + "\n";
+}
+
+void Lenc::enc_ct(Pointer<uint64_t> &s, shared_ptr<UniformRandomGenerator> random, AsyncPolyWriter &writer) {
+    const EncryptionParameters &parms = context_data_.parms();
+    size_t poly_modulus_degree = parms.poly_modulus_degree();
+    const vector<Modulus> &coeff_modulus = parms.coeff_modulus();
+    size_t coeff_modulus_size = coeff_modulus.size();
+    size_t w = params_.w, l = params_.l(), m = params_.m;
+
+    size_t window = writer.batch_polys() / (2*m);
+    if (!window) throw invalid_argument("the batches of writer need to hold at least one block");
+
+    PreparedPolys b_prepared(PolyIter(data_b_.get(), poly_modulus_degree, coeff_modulus_size), 2*m, coeff_modulus);
+
+    // the noise of every window is taken from the streams of its polynomials, as in enc_ct
+    prng_seed_type seed;
+    random->generate(prng_seed_byte_count, reinterpret_cast<seal_byte *>(seed.data()));
+
+    chrono::nanoseconds noise_time(0);
+    for (size_t first = 0; first < l*w; first += window) {
+        size_t count = min(window, l*w - first);
+        uint64_t *batch = writer.buffer();
+        enc_blocks(first, count, b_prepared, s.get(), batch);
+
+        auto begin = chrono::steady_clock::now();
+        add_poly_error(seed, first*2*m, count*2*m, context_data_, batch, noise_small_standard_deviation, noise_small_max_deviation, *pool);
+        noise_time += chrono::steady_clock::now() - begin;
+
+        writer.commit(count*2*m);
     }
-    for (size_t i = 0; i < l; ++i) {
-        PolyIter cti_iter = ct_iter + i*2*m*w;
-        for (size_t j = 0; j < w; ++j) {
-            PolyIter ctij_iter = cti_iter + j*2*m;
+    cerr << "Time used for generating noise: " + time_str(noise_time) + "\n";
+}
+
+void Lenc::enc_blocks(size_t first, size_t count, const PreparedPolys &b, const uint64_t *s, uint64_t *destination) {
+    const EncryptionParameters &parms = context_data_.parms();
+    size_t poly_modulus_degree = parms.poly_modulus_degree();
+    const vector<Modulus> &coeff_modulus = parms.coeff_modulus();
+    size_t coeff_modulus_size = coeff_modulus.size();
+    size_t w = params_.w, l = params_.l(), m = params_.m;
+
+    PolyIter r_iter(data_r_.get(), poly_modulus_degree, coeff_modulus_size);
+    PolyIter s_iter(const_cast<uint64_t *>(s), poly_modulus_degree, coeff_modulus_size);
+    PolyIter dest_iter(destination, poly_modulus_degree, coeff_modulus_size);
+
+    // Block (i, j) = ct_iter + ct_block(j, i) only depends on r[i*w + j] and on r[(i+1)*w + j] (or s[j]),
+    // so all l*w blocks can be computed independently. They are computed in the order of the layout,
+    // so that every thread writes a contiguous range of the ciphertext.
+    bool leaf_major = ct_layout_ == CtLayout::leaf_major;
+    pool->parallel_for(count, [&](size_t begin, size_t end) {
+        Pointer<uint64_t> temp = allocate_poly_array(m, poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
+        PolyIter temp_iter(temp.get(), poly_modulus_degree, coeff_modulus_size);
+
+        for (size_t k = first + begin; k < first + end; ++k) {
+            size_t i = leaf_major ? k % l : k / w, j = leaf_major ? k / l : k % w;
+            PolyIter ctij_iter = dest_iter + (k - first)*2*m;
+            kernels_.outer_product(r_iter + (i*w + j), 1, b, ctij_iter, coeff_modulus);
+
             if (j & (1 << (l-i-1))) ctij_iter = ctij_iter + m;
 
             RNSIter ri_iter = i == l-1 ? s_iter[j] : r_iter[(i+1)*w + j];
 
-            multiply_g(ri_iter, temp_iter, context_data_);
+            kernels_.multiply_g(ri_iter, temp_iter, params_, context_data_);
             add_poly_coeffmod(ctij_iter, temp_iter, m, coeff_modulus, ctij_iter);
         }
-    }
-
-    auto begin = chrono::steady_clock::now();
-    add_poly_error(l*w*2*m, prng, context_data_, data_ct_.get(), noise_small_standard_deviation, noise_small_max_deviation);
-    cerr << "Time used for generating noise: " << time_str(chrono::steady_clock::now() - begin) << "\n";
-
-    return data_r_;
+    });
 }
 
 /**
@@ -381,60 +751,236 @@ Pointer<uint64_t>& Lenc::digest(Pointer<uint64_t> &a) {
     size_t poly_modulus_degree = parms.poly_modulus_degree();
     const vector<Modulus> &coeff_modulus = parms.coeff_modulus();
     size_t coeff_modulus_size = coeff_modulus.size();
+    size_t w = params_.w, l = params_.l(), m = params_.m;
 
     data_digest_ = allocate_poly(poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
     data_tree_ = allocate_poly_array((2*w-1)*m, poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
-    Pointer<uint64_t> temp = allocate_poly(poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
+    digest_file_.reset();
+    tree_rebuilt_ = true;
+    eval_base_.clear();
 
     PolyIter a_iter(a.get(), poly_modulus_degree, coeff_modulus_size);
-    PolyIter b_iter(data_b_.get(), poly_modulus_degree, coeff_modulus_size);
     PolyIter tree_iter(data_tree_.get(), poly_modulus_degree, coeff_modulus_size);
-    RNSIter temp_iter(temp.get(), poly_modulus_degree);
 
-    for (size_t i = 0; i < w; ++i) {
-        decompose_g(a_iter[i], tree_iter + (w-1+i)*m, context_data_);
-    }
-    
-    for (size_t i = w-1; i-- > 0;) {
-        inner_product(b_iter, tree_iter + (2*i+1)*m, 2*m, temp_iter, coeff_modulus);
-        negate_poly_coeffmod(temp_iter, coeff_modulus_size, coeff_modulus, temp_iter);
-        if (i) { // we do not need the decomposition of the root
-            decompose_g(temp_iter, tree_iter + i*m, context_data_);
-        } else { // instead, we will store the digest separately
-            set_poly(temp.get(), poly_modulus_degree, coeff_modulus_size, data_digest_.get());
-        }
+    // The leaves are decomposed independently, and each thread decomposes its range in one batch.
+    pool->parallel_for(w, [&](size_t begin, size_t end) {
+        kernels_.decompose_g(a_iter + begin, end - begin, tree_iter + (w-1+begin)*m, params_, context_data_);
+    });
+
+    // Node i only depends on its children 2i+1 and 2i+2, so the tree is processed level by level
+    // (level d consists of nodes 2^d-1, ..., 2^(d+1)-2), with all nodes of a level in parallel,
+    // and node_batch consecutive nodes at a time.
+    for (size_t d = l; d-- > 0;) {
+        size_t first = ((size_t)1 << d) - 1;
+        pool->parallel_for((size_t)1 << d, [&](size_t begin, size_t end) {
+            Pointer<uint64_t> temp = allocate_poly_array(min(end - begin, node_batch), poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
+            for (size_t i = first + begin; i < first + end; i += node_batch) {
+                digest_nodes(i, min(first + end - i, node_batch), temp.get());
+            }
+        });
     }
 
     return data_digest_;
 }
 
 /**
-Takes a, and computes delta from ct and y.
-digest(a) needs to be called first!
+Computes the nodes first, ..., first+count-1 of the tree from the decompositions of their
+children, using temp as scratch space for count polynomials.
 */
-Pointer<uint64_t>& Lenc::eval(Pointer<uint64_t> &a) {
+void Lenc::digest_nodes(size_t first, size_t count, uint64_t *temp) {
     const EncryptionParameters &parms = context_data_.parms();
     size_t poly_modulus_degree = parms.poly_modulus_degree();
     const vector<Modulus> &coeff_modulus = parms.coeff_modulus();
     size_t coeff_modulus_size = coeff_modulus.size();
+    size_t m = params_.m;
 
-    data_delta_ = allocate_poly_array(w, poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
-    Pointer<uint64_t> temp = allocate_poly(poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
+    PolyIter b_iter(data_b_.get(), poly_modulus_degree, coeff_modulus_size);
+    PolyIter tree_iter(data_tree_.get(), poly_modulus_degree, coeff_modulus_size);
+    PolyIter temp_iter(temp, poly_modulus_degree, coeff_modulus_size);
+
+    for (size_t c = 0; c < count; ++c) {
+        kernels_.inner_product(b_iter, tree_iter + (2*(first + c)+1)*m, 2*m, temp_iter[c], coeff_modulus);
+    }
+    negate_poly_coeffmod(temp_iter, count, coeff_modulus, temp_iter);
+    if (first) { // we do not need the decomposition of the root
+        kernels_.decompose_g(temp_iter, count, tree_iter + first*m, params_, context_data_);
+    } else { // instead, we will store the digest separately (the root is alone on its level)
+        set_poly(temp, poly_modulus_degree, coeff_modulus_size, data_digest_.get());
+    }
+}
+
+/**
+Computes delta (w polynomials) from ct and the decomposed tree of the current digest, evaluating
+all w*l terms. digest (or update_digest, or map_digest) needs to be called first!
+This eval becomes the base of later incremental updates: the record of changed nodes is cleared,
+and the tree counts as not replaced, so that update_eval can correct delta after update_digest
+(see can_update_eval); after digest or map_digest, eval needs to be called again.
+*/
+Pointer<uint64_t>& Lenc::eval() {
+    data_delta_ = allocate_poly_array(params_.w, params_.poly_modulus_degree, coeff_modulus_size(), MemoryManager::GetPool());
+    tree_rebuilt_ = false;
+    eval_base_.clear();
+
+    eval_many({ data_tree_.get() }, { data_delta_.get() });
+    return data_delta_;
+}
+
+void Lenc::eval_many(const vector<uint64_t *> &trees, const vector<uint64_t *> &deltas) {
+    if (ct_file_) {
+        // start reading the rest of the mapped ciphertext while the first leaves are evaluated
+        ct_file_->will_need(data_ct_.get(), ct_poly_count()*poly_size()*8);
+    }
+    eval_leaves(trees, 0, params_.w, deltas);
+}
+
+void Lenc::release_leaves(size_t first, size_t count) {
+    if (!ct_file_ || !count) return;
+    size_t block_bytes = 2*params_.m*poly_size()*8;
+    // the blocks of the leaves are contiguous in the leaf-major layout, and on every level otherwise
+    if (ct_layout_ == CtLayout::leaf_major) {
+        ct_file_->dont_need(data_ct_.get() + ct_block(first, 0)*poly_size(), count*params_.l()*block_bytes);
+        return;
+    }
+    for (size_t j = 0; j < params_.l(); ++j) {
+        ct_file_->dont_need(data_ct_.get() + ct_block(first, j)*poly_size(), count*block_bytes);
+    }
+}
+
+void Lenc::eval_leaves(const vector<uint64_t *> &trees, size_t first, size_t count, const vector<uint64_t *> &deltas) {
+    const EncryptionParameters &parms = context_data_.parms();
+    size_t poly_modulus_degree = parms.poly_modulus_degree();
+    const vector<Modulus> &coeff_modulus = parms.coeff_modulus();
+    size_t coeff_modulus_size = coeff_modulus.size();
+    size_t l = params_.l(), m = params_.m;
+    size_t queries = trees.size();
 
-    PolyIter delta_iter(data_delta_.get(), poly_modulus_degree, coeff_modulus_size);
     PolyIter ct_iter(data_ct_.get(), poly_modulus_degree, coeff_modulus_size);
+
+    // Every leaf is evaluated independently. Each block of the ciphertext is used for all trees
+    // right after another, so that it is read from memory only once.
+    pool->parallel_for(count, [&](size_t begin, size_t end) {
+        Pointer<uint64_t> temp = allocate_poly(poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
+        RNSIter temp_iter(temp.get(), poly_modulus_degree);
+
+        for (size_t i = first + begin; i < first + end; ++i) {
+            for (size_t q = 0; q < queries; ++q) {
+                PolyIter tree_iter(trees[q], poly_modulus_degree, coeff_modulus_size);
+                kernels_.inner_product(ct_iter + ct_block(i, 0), tree_iter + m, 2*m, PolyIter(deltas[q], poly_modulus_degree, coeff_modulus_size)[i - first], coeff_modulus);
+            }
+            for (size_t j = 1; j < l; ++j) {
+                for (size_t q = 0; q < queries; ++q) {
+                    PolyIter tree_iter(trees[q], poly_modulus_degree, coeff_modulus_size);
+                    RNSIter delta_iter = PolyIter(deltas[q], poly_modulus_degree, coeff_modulus_size)[i - first];
+                    kernels_.inner_product(ct_iter + ct_block(i, j), tree_iter + (((i >> (l-j)) + (1 << j) - 1)*2 + 1)*m, 2*m, temp_iter, coeff_modulus);
+                    add_poly_coeffmod(delta_iter, temp_iter, coeff_modulus_size, coeff_modulus, delta_iter);
+                }
+            }
+            for (size_t q = 0; q < queries; ++q) {
+                RNSIter delta_iter = PolyIter(deltas[q], poly_modulus_degree, coeff_modulus_size)[i - first];
+                negate_poly_coeffmod(delta_iter, coeff_modulus_size, coeff_modulus, delta_iter);
+            }
+        }
+    });
+}
+
+Pointer<uint64_t>& Lenc::update_digest(Pointer<uint64_t> &a, const vector<size_t> &changed_leaves) {
+    const EncryptionParameters &parms = context_data_.parms();
+    size_t poly_modulus_degree = parms.poly_modulus_degree();
+    const vector<Modulus> &coeff_modulus = parms.coeff_modulus();
+    size_t coeff_modulus_size = coeff_modulus.size();
+    size_t w = params_.w, l = params_.l(), m = params_.m;
+
+    // the changed nodes of each level, from the leaves up to the root
+    vector<vector<size_t>> levels(l + 1);
+    for (size_t i : changed_leaves) {
+        if (i >= w) throw invalid_argument("leaf index out of range");
+        levels[l].push_back(w - 1 + i);
+    }
+    for (size_t d = l + 1; d-- > 0;) {
+        sort(levels[d].begin(), levels[d].end());
+        levels[d].erase(unique(levels[d].begin(), levels[d].end()), levels[d].end());
+        if (d) {
+            for (size_t node : levels[d]) {
+                levels[d - 1].push_back((node - 1) / 2);
+            }
+        }
+    }
+
+    PolyIter a_iter(a.get(), poly_modulus_degree, coeff_modulus_size);
     PolyIter tree_iter(data_tree_.get(), poly_modulus_degree, coeff_modulus_size);
-    RNSIter temp_iter(temp.get(), poly_modulus_degree);
 
-    SEAL_ITERATE(iter(seq_iter(0), delta_iter), w, [&](const tuple<uint64_t,RNSIter> &I) {
-        inner_product(ct_iter + (2*m)*get<0>(I), tree_iter + m, 2*m, get<1>(I), coeff_modulus);
-        for (size_t j = 1; j < l; ++j) {
-            inner_product(ct_iter + (2*m*w)*j + (2*m)*get<0>(I), tree_iter + (((get<0>(I) >> (l-j)) + (1 << j) - 1)*2 + 1)*m, 2*m, temp_iter, coeff_modulus);
-            add_poly_coeffmod(get<1>(I), temp_iter, coeff_modulus_size, coeff_modulus, get<1>(I));
+    // keep the values at the time of the last eval, for update_eval (the root is not part of the tree)
+    if (can_update_eval()) {
+        for (size_t d = 1; d <= l; ++d) {
+            for (size_t node : levels[d]) {
+                if (eval_base_.count(node)) continue;
+                Pointer<uint64_t> &base = eval_base_[node];
+                base = allocate_poly_array(m, poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
+                set_poly_array(tree_iter[node*m], m, poly_modulus_degree, coeff_modulus_size, base.get());
+            }
+        }
+    }
+
+    pool->parallel_for(levels[l].size(), [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; ++k) {
+            size_t node = levels[l][k];
+            kernels_.decompose_g(a_iter + (node - (w - 1)), 1, tree_iter + node*m, params_, context_data_);
         }
     });
-    negate_poly_coeffmod(delta_iter, w, coeff_modulus, delta_iter);
-    
+    for (size_t d = l; d-- > 0;) {
+        pool->parallel_for(levels[d].size(), [&](size_t begin, size_t end) {
+            Pointer<uint64_t> temp = allocate_poly(poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
+            for (size_t k = begin; k < end; ++k) {
+                digest_nodes(levels[d][k], 1, temp.get());
+            }
+        });
+    }
+
+    return data_digest_;
+}
+
+Pointer<uint64_t>& Lenc::update_eval() {
+    const EncryptionParameters &parms = context_data_.parms();
+    size_t poly_modulus_degree = parms.poly_modulus_degree();
+    const vector<Modulus> &coeff_modulus = parms.coeff_modulus();
+    size_t coeff_modulus_size = coeff_modulus.size();
+    size_t w = params_.w, l = params_.l(), m = params_.m;
+
+    if (!can_update_eval()) {
+        throw logic_error("the tree was replaced since the last eval");
+    }
+
+    // the differences of the changed nodes to their values at the last eval, which replace these values
+    vector<uint64_t *> diff(2*w - 1, nullptr);
+    for (auto &node : eval_base_) {
+        PolyIter base_iter(node.second.get(), poly_modulus_degree, coeff_modulus_size);
+        sub_poly_coeffmod(PolyIter(data_tree_.get(), poly_modulus_degree, coeff_modulus_size) + node.first*m, base_iter, m, coeff_modulus, base_iter);
+        diff[node.first] = node.second.get();
+    }
+
+    PolyIter delta_iter(data_delta_.get(), poly_modulus_degree, coeff_modulus_size);
+    PolyIter ct_iter(data_ct_.get(), poly_modulus_degree, coeff_modulus_size);
+
+    // The term of leaf i on level j is the product of its ciphertext block with the two children of
+    // the ancestor of i on level j (see eval); only the terms with a changed child are corrected.
+    pool->parallel_for(w, [&](size_t begin, size_t end) {
+        Pointer<uint64_t> temp = allocate_poly(poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
+        RNSIter temp_iter(temp.get(), poly_modulus_degree);
+
+        for (size_t i = begin; i < end; ++i) {
+            for (size_t j = 0; j < l; ++j) {
+                size_t left = ((i >> (l-j)) + ((size_t)1 << j) - 1)*2 + 1;
+                for (size_t side = 0; side < 2; ++side) {
+                    if (!diff[left + side]) continue;
+                    PolyIter diff_iter(diff[left + side], poly_modulus_degree, coeff_modulus_size);
+                    kernels_.inner_product(ct_iter + ct_block(i, j) + side*m, diff_iter, m, temp_iter, coeff_modulus);
+                    sub_poly_coeffmod(delta_iter[i], temp_iter, coeff_modulus_size, coeff_modulus, delta_iter[i]);
+                }
+            }
+        }
+    });
+
+    eval_base_.clear();
     return data_delta_;
 }
 
@@ -449,11 +995,120 @@ void BatchSelect::setup() {
     cerr << "Setup done in " << time_str(chrono::steady_clock::now() - begin) << ".\n";
 }
 
-void BatchSelect::enc1(Pointer<uint64_t> &l1) { // l1 should have size w * poly_modulus_degree
+void BatchSelect::save_pp(FILE* f, bool seeded) {
+    ContainerWriter writer(f, Artifact::pp, params_hash(params_, context_data_), 2);
+    lhe.save_pp(writer.begin_section("LHE"), seeded);
+    writer.end_section(*pool);
+    lenc.save_pp(writer.begin_section("LENC"), seeded);
+    writer.end_section(*pool);
+    writer.finish();
+}
+
+void BatchSelect::read_pp(FILE* f) {
+    ContainerReader reader(f, Artifact::pp, params_hash(params_, context_data_));
+    lhe.read_pp(reader.section("LHE", *pool));
+    lenc.read_pp(reader.section("LENC", *pool));
+}
+
+void BatchSelect::map_pp(const string &path) {
+    auto file = make_shared<MappedFile>(path);
+    ContainerReader reader(file, Artifact::pp, params_hash(params_, context_data_));
+    size_t offset = reader.section_offset("LHE");
+    lhe.map_pp(file, offset);
+    offset = reader.section_offset("LENC");
+    lenc.map_pp(file, offset);
+}
+
+void BatchSelect::save_st1(FILE* f, bool packed) {
+    ContainerWriter writer(f, Artifact::st1, params_hash(params_, context_data_), 1);
+    lhe.save_st1(writer.begin_section("LHE"), packed);
+    writer.end_section(*pool);
+    writer.finish();
+}
+
+// The Lenc ciphertext is stored in the section LENC, or in LENCLEAF if it is in leaf-major layout.
+const char *BatchSelect::ct_section(CtLayout layout) {
+    return layout == CtLayout::leaf_major ? "LENCLEAF" : "LENC";
+}
+
+void BatchSelect::save_ct1(FILE* f, bool packed) {
+    ContainerWriter writer(f, Artifact::ct1, params_hash(params_, context_data_), 2);
+    lhe.save_ct1(writer.begin_section("LHE"), packed);
+    writer.end_section(*pool);
+    lenc.save_ct1(writer.begin_section(ct_section(lenc.ct_layout_)), packed);
+    writer.end_section(*pool);
+    writer.finish();
+}
+
+void BatchSelect::read_st1(FILE* f) {
+    ContainerReader reader(f, Artifact::st1, params_hash(params_, context_data_));
+    lhe.read_st1(reader.section("LHE", *pool));
+}
+
+void BatchSelect::read_ct1(FILE* f) {
+    ContainerReader reader(f, Artifact::ct1, params_hash(params_, context_data_));
+    lhe.read_ct1(reader.section("LHE", *pool));
+    lenc.ct_layout_ = ct_layout = reader.contains(ct_section(CtLayout::leaf_major)) ? CtLayout::leaf_major : CtLayout::level_major;
+    lenc.read_ct1(reader.section(ct_section(ct_layout), *pool));
+}
+
+void BatchSelect::map_ct1(const string &path) {
+    auto file = make_shared<MappedFile>(path);
+    ContainerReader reader(file, Artifact::ct1, params_hash(params_, context_data_));
+    size_t offset = reader.section_offset("LHE");
+    lhe.map_ct1(file, offset);
+    lenc.ct_layout_ = ct_layout = reader.contains(ct_section(CtLayout::leaf_major)) ? CtLayout::leaf_major : CtLayout::level_major;
+    offset = reader.section_offset(ct_section(ct_layout));
+    lenc.map_ct1(file, offset);
+}
+
+void BatchSelect::save_st2(FILE* f, bool packed) {
+    ContainerWriter writer(f, Artifact::st2, params_hash(params_, context_data_), 1);
+    lhe.save_st2(writer.begin_section("LHE"), packed);
+    writer.end_section(*pool);
+    writer.finish();
+}
+
+void BatchSelect::read_st2(FILE* f) {
+    ContainerReader reader(f, Artifact::st2, params_hash(params_, context_data_));
+    lhe.read_st2(reader.section("LHE", *pool));
+}
+
+void BatchSelect::save_ct2(FILE* f, bool packed) {
+    ContainerWriter writer(f, Artifact::ct2, params_hash(params_, context_data_), 1);
+    lhe.save_ct2(writer.begin_section("LHE"), packed);
+    writer.end_section(*pool);
+    writer.finish();
+}
+
+void BatchSelect::read_ct2(FILE* f) {
+    ContainerReader reader(f, Artifact::ct2, params_hash(params_, context_data_));
+    lhe.read_ct2(reader.section("LHE", *pool));
+}
+
+void BatchSelect::save_sk(FILE* f, bool packed) {
+    ContainerWriter writer(f, Artifact::sk, params_hash(params_, context_data_), 1);
+    lhe.save_sk(writer.begin_section("LHE"), packed);
+    writer.end_section(*pool);
+    writer.finish();
+}
+
+void BatchSelect::read_sk(FILE* f) {
+    ContainerReader reader(f, Artifact::sk, params_hash(params_, context_data_));
+    lhe.read_sk(reader.section("LHE", *pool));
+}
+
+void BatchSelect::enc1(Pointer<uint64_t> &l1) {
+    enc1(l1, nullptr, false, 0);
+}
+
+// Keeps the Lenc ciphertext in memory if f is null.
+void BatchSelect::enc1(Pointer<uint64_t> &l1, FILE* f, bool packed, size_t window) {
     const EncryptionParameters &parms = context_data_.parms();
     size_t poly_modulus_degree = parms.poly_modulus_degree();
     const vector<Modulus> &coeff_modulus = parms.coeff_modulus();
     size_t coeff_modulus_size = coeff_modulus.size();
+    size_t w = params_.w;
 
     Pointer<uint64_t> temp = allocate_zero_poly_array(w, poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
 
@@ -464,15 +1119,49 @@ void BatchSelect::enc1(Pointer<uint64_t> &l1) { // l1 should have size w * poly_
         multiply_poly_scalar_coeffmod(temp_iter[i][0], poly_modulus_degree, coeff_modulus[1].value(), coeff_modulus[0], temp_iter[i][0]);
     }
 
-    auto begin = chrono::steady_clock::now();
-    cerr << "Lenc encryption...\n";
-    Pointer<uint64_t> &r = lenc.enc(temp);
-    cerr << "Lenc encryption done in " << time_str(chrono::steady_clock::now() - begin) << ".\n";
+    lenc.ct_layout_ = ct_layout;
+    unique_ptr<ContainerWriter> writer;
+    unique_ptr<AsyncPolyWriter> ct_writer;
+    if (f) {
+        writer = make_unique<ContainerWriter>(f, Artifact::ct1, params_hash(params_, context_data_), 2);
+        ct_writer = make_unique<AsyncPolyWriter>(writer->begin_section(ct_section(ct_layout)), lenc.ct_poly_count(), lenc.poly_format(), packed, window*2*params_.m);
+    }
 
-    begin = chrono::steady_clock::now();
-    cerr << "LHE encryption 1...\n";
-    lhe.enc1(r);
-    cerr << "LHE encryption 1 done in " << time_str(chrono::steady_clock::now() - begin) << ".\n";
+    // The LHE encryption only needs r, so it runs at the same time as the Lenc encryption. Each of
+    // them draws from its own stream, derived from a seed drawn up front, so that the ciphertexts do
+    // not depend on which one draws first. The messages are written as single strings, so that the
+    // lines of both do not interleave.
+    prng_seed_type seed;
+    prng->generate(prng_seed_byte_count, reinterpret_cast<seal_byte *>(seed.data()));
+    shared_ptr<UniformRandomGenerator> lenc_random = derive_prng(seed, 0), lhe_random = derive_prng(seed, 1);
+
+    TaskGraph graph(*pool);
+    TaskGraph::Task r_task = graph.add([&] { lenc.sample_r(); });
+    graph.add([&] {
+        auto begin = chrono::steady_clock::now();
+        cerr << "Lenc encryption...\n";
+        if (ct_writer) {
+            lenc.enc_ct(temp, lenc_random, *ct_writer);
+            ct_writer->finish();
+        } else {
+            lenc.enc_ct(temp, lenc_random);
+        }
+        cerr << "Lenc encryption done in " + time_str(chrono::steady_clock::now() - begin) + ".\n";
+    }, { r_task });
+    graph.add([&] {
+        auto begin = chrono::steady_clock::now();
+        cerr << "LHE encryption 1...\n";
+        lhe.enc1(lenc.data_r_, lhe_random);
+        cerr << "LHE encryption 1 done in " + time_str(chrono::steady_clock::now() - begin) + ".\n";
+    }, { r_task });
+    graph.run();
+
+    if (writer) {
+        writer->end_section(*pool);
+        lhe.save_ct1(writer->begin_section("LHE"), packed);
+        writer->end_section(*pool);
+        writer->finish();
+    }
 }
 
 void BatchSelect::enc2(Pointer<uint64_t> &l2) {
@@ -480,6 +1169,7 @@ void BatchSelect::enc2(Pointer<uint64_t> &l2) {
     size_t poly_modulus_degree = parms.poly_modulus_degree();
     const vector<Modulus> &coeff_modulus = parms.coeff_modulus();
     size_t coeff_modulus_size = coeff_modulus.size();
+    size_t w = params_.w;
 
     Pointer<uint64_t> temp = allocate_zero_poly_array(w, poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
 
@@ -490,7 +1180,7 @@ void BatchSelect::enc2(Pointer<uint64_t> &l2) {
         multiply_poly_scalar_coeffmod(temp_iter[i][0], poly_modulus_degree, coeff_modulus[1].value(), coeff_modulus[0], temp_iter[i][0]);
     }
 
-    add_poly_error(w, prng, context_data_, temp.get(), noise_large_standard_deviation, noise_large_max_deviation);
+    add_poly_error(w, prng, context_data_, temp.get(), noise_large_standard_deviation, noise_large_max_deviation, *pool);
 
     auto begin = chrono::steady_clock::now();
     cerr << "LHE encryption 2...\n";
@@ -498,17 +1188,18 @@ void BatchSelect::enc2(Pointer<uint64_t> &l2) {
     cerr << "LHE encryption 2 done in " << time_str(chrono::steady_clock::now() - begin) << ".\n";
 }
 
-void BatchSelect::keygen(Pointer<uint64_t> &y) {
+Pointer<uint64_t> BatchSelect::encode_y(Pointer<uint64_t> &y, const vector<size_t> &blocks) {
     const EncryptionParameters &parms = context_data_.parms();
     size_t poly_modulus_degree = parms.poly_modulus_degree();
     const vector<Modulus> &coeff_modulus = parms.coeff_modulus();
     size_t coeff_modulus_size = coeff_modulus.size();
+    size_t w = params_.w;
 
     Pointer<uint64_t> temp = allocate_zero_poly_array(w, poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
 
     PolyIter temp_iter(temp.get(), poly_modulus_degree, coeff_modulus_size);
 
-    for (size_t i = 0; i < w; ++i) {
+    for (size_t i : blocks) {
         for (size_t j = 0; j < poly_modulus_degree; ++j) {
             if (y[i*poly_modulus_degree+j]) {
                 temp_iter[i][0][j] = 1;
@@ -519,72 +1210,348 @@ void BatchSelect::keygen(Pointer<uint64_t> &y) {
         ntt_negacyclic_harvey(temp_iter[i][1], context_data_.small_ntt_tables()[1]);
     }
 
+    return temp;
+}
+
+Pointer<uint64_t> BatchSelect::encode_y(Pointer<uint64_t> &y) {
+    vector<size_t> blocks(params_.w);
+    iota(blocks.begin(), blocks.end(), 0);
+    return encode_y(y, blocks);
+}
+
+vector<uint64_t> BatchSelect::y_bitset(Pointer<uint64_t> &y) const {
+    size_t count = params_.label_count();
+    vector<uint64_t> bits(count), result((count + 63) / 64);
+    for (size_t i = 0; i < count; ++i) {
+        bits[i] = y[i] ? 1 : 0;
+    }
+    pack_bits(bits.data(), count, 1, result.data());
+    return result;
+}
+
+vector<size_t> BatchSelect::changed_blocks(const uint64_t *a, const uint64_t *b) const {
+    // a block consists of N bits, i.e., N/64 words
+    size_t block_words = params_.poly_modulus_degree / 64;
+    vector<size_t> result;
+    for (size_t i = 0; i < params_.w; ++i) {
+        if (!equal(a + i*block_words, a + (i+1)*block_words, b + i*block_words)) {
+            result.push_back(i);
+        }
+    }
+    return result;
+}
+
+ParamsHash BatchSelect::b_hash() const {
+    ParamsHash result;
+    HashFunction::hash(lenc.data_b_.get(), 2*params_.m*lenc.poly_size(), result);
+    return result;
+}
+
+bool BatchSelect::load_digest(const string &path, const ParamsHash &b_key, const vector<uint64_t> &y_bits, vector<size_t> &changed) {
+    if (FILE *f = fopen(path.c_str(), "rb")) {
+        fclose(f);
+    } else {
+        return false; // no cache yet
+    }
+    try {
+        auto file = make_shared<MappedFile>(path);
+        ContainerReader reader(file, Artifact::digest, params_hash(params_, context_data_));
+        const ContainerSection &key = reader.find("KEY");
+        if (key.size != sizeof(b_key) || memcmp(file->data() + key.offset, b_key.data(), sizeof(b_key))) {
+            return false;
+        }
+        if (reader.find("Y").size != y_bits.size()*8) {
+            return false;
+        }
+        // unlike pp and ct1, the cache is verified, as a corrupted tree would silently give wrong results
+        reader.verify("Y", *pool);
+        reader.verify("LENC", *pool);
+        changed = changed_blocks(reinterpret_cast<const uint64_t *>(file->data() + reader.section_offset("Y")), y_bits.data());
+        size_t offset = reader.section_offset("LENC");
+        lenc.map_digest(file, offset);
+        return true;
+    } catch (const runtime_error &e) {
+        cerr << "Ignoring digest cache: " << e.what() << "\n";
+        return false;
+    }
+}
+
+void BatchSelect::save_digest(const string &path, const ParamsHash &b_key, const vector<uint64_t> &y_bits) {
+    // written to a temporary file first, so that other processes never see a partial cache
+    string temp_path = path + ".tmp";
+    FILE *f = fopen(temp_path.c_str(), "w+b");
+    if (!f) {
+        cerr << "Cannot write digest cache " << temp_path << "\n";
+        return;
+    }
+    ContainerWriter writer(f, Artifact::digest, params_hash(params_, context_data_), 3);
+    fwrite(b_key.data(), 8, b_key.size(), writer.begin_section("KEY"));
+    writer.end_section(*pool);
+    fwrite(y_bits.data(), 8, y_bits.size(), writer.begin_section("Y"));
+    writer.end_section(*pool);
+    lenc.save_digest(writer.begin_section("LENC"));
+    writer.end_section(*pool);
+    writer.finish();
+    if (fclose(f) || rename(temp_path.c_str(), path.c_str())) {
+        cerr << "Cannot write digest cache " << path << "\n";
+        remove(temp_path.c_str());
+    }
+}
+
+Pointer<uint64_t>& BatchSelect::update_digest(Pointer<uint64_t> &y, const vector<size_t> &changed) {
+    auto begin = chrono::steady_clock::now();
+    cerr << "Updating Lenc digest for " << changed.size() << " changed blocks...\n";
+    Pointer<uint64_t> temp = encode_y(y, changed);
+    Pointer<uint64_t> &result = lenc.update_digest(temp, changed);
+    cerr << "Updating Lenc digest done in " << time_str(chrono::steady_clock::now() - begin) << ".\n";
+    return result;
+}
+
+Pointer<uint64_t>& BatchSelect::digest(Pointer<uint64_t> &y, bool save_cache) {
+    vector<uint64_t> y_bits = y_bitset(y);
+    if (!digest_y_.empty()) {
+        vector<size_t> changed = changed_blocks(digest_y_.data(), y_bits.data());
+        digest_y_ = y_bits;
+        if (changed.empty()) {
+            return lenc.data_digest_;
+        }
+        Pointer<uint64_t> &result = update_digest(y, changed);
+        digest_unsaved_ = true;
+        if (save_cache) {
+            save_digest_cache();
+        }
+        return result;
+    }
+    digest_y_ = y_bits;
+
     auto begin = chrono::steady_clock::now();
+    if (!digest_cache.empty()) {
+        ParamsHash b_key = b_hash();
+        vector<size_t> changed;
+        if (load_digest(digest_cache, b_key, y_bits, changed)) {
+            cerr << "Lenc digest loaded from " << digest_cache << " in " << time_str(chrono::steady_clock::now() - begin) << ".\n";
+            if (changed.empty()) {
+                return lenc.data_digest_;
+            }
+            Pointer<uint64_t> &result = update_digest(y, changed);
+            digest_unsaved_ = true;
+            if (save_cache) {
+                save_digest_cache();
+            }
+            return result;
+        }
+    }
+
+    Pointer<uint64_t> temp = encode_y(y);
+
+    begin = chrono::steady_clock::now();
     cerr << "Computing Lenc digest...\n";
-    Pointer<uint64_t> &digest = lenc.digest(temp);
+    Pointer<uint64_t> &result = lenc.digest(temp);
     cerr << "Computing Lenc digest done in " << time_str(chrono::steady_clock::now() - begin) << ".\n";
 
-    begin = chrono::steady_clock::now();
+    digest_unsaved_ = true;
+    if (save_cache) {
+        save_digest_cache();
+    }
+    return result;
+}
+
+void BatchSelect::save_digest_cache() {
+    if (digest_unsaved_ && !digest_cache.empty()) {
+        save_digest(digest_cache, b_hash(), digest_y_);
+    }
+    digest_unsaved_ = false;
+}
+
+void BatchSelect::keygen(Pointer<uint64_t> &y, bool save_cache) {
+    Pointer<uint64_t> &d = digest(y, save_cache);
+
+    auto begin = chrono::steady_clock::now();
     cerr << "LHE keygen...\n";
-    lhe.keygen(digest);
+    lhe.keygen(d);
     cerr << "LHE keygen done in " << time_str(chrono::steady_clock::now() - begin) << ".\n";
 }
 
+void BatchSelect::keygen_many(vector<Pointer<uint64_t>> &ys, vector<Pointer<uint64_t>> &sks) {
+    sks.resize(ys.size());
+    // the digest cache is only written once, for the last query
+    for (size_t q = 0; q < ys.size(); ++q) {
+        keygen(ys[q], false);
+        sks[q] = sk();
+    }
+    save_digest_cache();
+}
+
+Pointer<uint64_t> BatchSelect::sk() const {
+    Pointer<uint64_t> result = allocate_poly(params_.poly_modulus_degree, lhe.coeff_modulus_size(), MemoryManager::GetPool());
+    set_poly(lhe.data_sk_.get(), params_.poly_modulus_degree, lhe.coeff_modulus_size(), result.get());
+    return result;
+}
+
+void BatchSelect::set_sk(const Pointer<uint64_t> &sk) {
+    lhe.data_sk_ = allocate_poly(params_.poly_modulus_degree, lhe.coeff_modulus_size(), MemoryManager::GetPool());
+    set_poly(sk.get(), params_.poly_modulus_degree, lhe.coeff_modulus_size(), lhe.data_sk_.get());
+}
+
 void BatchSelect::dec(Pointer<uint64_t> &y, Pointer<uint64_t> &out) {
+    const EncryptionParameters &parms = context_data_.parms();
+    size_t poly_modulus_degree = parms.poly_modulus_degree();
+    const vector<Modulus> &coeff_modulus = parms.coeff_modulus();
+    size_t w = params_.w;
+
+    // The LHE decryption and the Lenc evaluation both only depend on the digest, and run at the
+    // same time; each block of the result is decoded as soon as both are done.
+    TaskGraph graph(*pool);
+    Pointer<uint64_t> *d = nullptr, *res = nullptr, *delta = nullptr;
+    TaskGraph::Task digest_task = graph.add([&] { d = &digest(y); });
+    TaskGraph::Task lhe_task = graph.add([&] {
+        auto begin = chrono::steady_clock::now();
+        cerr << "LHE decryption...\n";
+        res = &lhe.dec(*d);
+        cerr << "LHE decryption done in " + time_str(chrono::steady_clock::now() - begin) + ".\n";
+    }, { digest_task });
+    TaskGraph::Task lenc_task = graph.add([&] {
+        auto begin = chrono::steady_clock::now();
+        bool update = lenc.can_update_eval();
+        string name = update ? "Updating Lenc evaluation" : "Lenc evaluation";
+        cerr << name + "...\n";
+        delta = update ? &lenc.update_eval() : &lenc.eval();
+        cerr << name + " done in " + time_str(chrono::steady_clock::now() - begin) + ".\n";
+    }, { digest_task });
+    graph.add([&] {
+        PolyIter res_iter(res->get(), poly_modulus_degree, coeff_modulus.size());
+        PolyIter delta_iter(delta->get(), poly_modulus_degree, coeff_modulus.size());
+        pool->parallel_for(w, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                sub_poly_coeffmod(res_iter[i], delta_iter[i], coeff_modulus.size(), coeff_modulus, res_iter[i]);
+                kernels_.decode(res_iter[i], out.get() + i*poly_modulus_degree, context_data_);
+            }
+        });
+    }, { lhe_task, lenc_task });
+    graph.run();
+}
+
+void BatchSelect::dec(Pointer<uint64_t> &y, size_t slice, const LabelSink &sink) {
     const EncryptionParameters &parms = context_data_.parms();
     size_t poly_modulus_degree = parms.poly_modulus_degree();
     const vector<Modulus> &coeff_modulus = parms.coeff_modulus();
     size_t coeff_modulus_size = coeff_modulus.size();
+    size_t w = params_.w;
 
-    Pointer<uint64_t> temp = allocate_zero_poly_array(w, poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
+    if (!slice) {
+        throw invalid_argument("slice needs to be positive");
+    }
+    slice = min(slice, w);
 
-    PolyIter temp_iter(temp.get(), poly_modulus_degree, coeff_modulus_size);
+    Pointer<uint64_t> &d = digest(y);
 
-    for (size_t i = 0; i < w; ++i) {
-        for (size_t j = 0; j < poly_modulus_degree; ++j) {
-            if (y[i*poly_modulus_degree+j]) {
-                temp_iter[i][0][j] = 1;
-            }
+    auto begin = chrono::steady_clock::now();
+    cerr << "Decryption in slices of " << slice << " blocks...\n";
+    Pointer<uint64_t> y_decomposed = lhe.decompose_ys({ d.get() });
+    vector<PreparedPolys> sks = lhe.prepare_sks({ lhe.data_sk_.get() });
+
+    // the buffers of one slice, reused for all slices
+    Pointer<uint64_t> res = allocate_poly_array(slice, poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
+    Pointer<uint64_t> delta = allocate_poly_array(slice, poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
+    vector<uint64_t> labels(slice*poly_modulus_degree);
+    PolyIter res_iter(res.get(), poly_modulus_degree, coeff_modulus_size);
+    PolyIter delta_iter(delta.get(), poly_modulus_degree, coeff_modulus_size);
+
+    for (size_t first = 0; first < w; first += slice) {
+        size_t count = min(slice, w - first);
+
+        // as in dec, the LHE decryption and the Lenc evaluation of the slice run at the same time
+        TaskGraph graph(*pool);
+        TaskGraph::Task lhe_task = graph.add([&] {
+            lhe.dec_blocks(y_decomposed.get(), sks, first, count, { res.get() });
+        });
+        TaskGraph::Task lenc_task = graph.add([&] {
+            lenc.eval_leaves({ lenc.data_tree_.get() }, first, count, { delta.get() });
+        });
+        graph.add([&] {
+            pool->parallel_for(count, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i) {
+                    sub_poly_coeffmod(res_iter[i], delta_iter[i], coeff_modulus_size, coeff_modulus, res_iter[i]);
+                    kernels_.decode(res_iter[i], labels.data() + i*poly_modulus_degree, context_data_);
+                }
+            });
+        }, { lhe_task, lenc_task });
+        graph.run();
+
+        // the ciphertext blocks of the slice are not used again
+        lhe.release_blocks(first, count);
+        lenc.release_leaves(first, count);
+
+        if (!first) {
+            cerr << "First slice decrypted in " << time_str(chrono::steady_clock::now() - begin) << ".\n";
         }
-        set_uint(temp_iter[i][0], poly_modulus_degree, temp_iter[i][1]);
-        inverse_ntt_negacyclic_harvey(temp_iter[i][1], *context_data_.plain_ntt_tables());
-        ntt_negacyclic_harvey(temp_iter[i][1], context_data_.small_ntt_tables()[1]);
+        sink(first, count, labels.data());
     }
+    cerr << "Decryption in slices done in " << time_str(chrono::steady_clock::now() - begin) << ".\n";
+}
 
-    auto begin = chrono::steady_clock::now();
-    cerr << "Computing Lenc digest...\n";
-    Pointer<uint64_t> &digest = lenc.digest(temp);
-    cerr << "Computing Lenc digest done in " << time_str(chrono::steady_clock::now() - begin) << ".\n";
-
-    begin = chrono::steady_clock::now();
-    cerr << "LHE decryption...\n";
-    Pointer<uint64_t> &res = lhe.dec(digest);
-    cerr << "LHE decryption done in " << time_str(chrono::steady_clock::now() - begin) << ".\n";
+void BatchSelect::dec_many(vector<Pointer<uint64_t>> &ys, vector<Pointer<uint64_t>> &sks, vector<Pointer<uint64_t>> &outs) {
+    const EncryptionParameters &parms = context_data_.parms();
+    size_t poly_modulus_degree = parms.poly_modulus_degree();
+    const vector<Modulus> &coeff_modulus = parms.coeff_modulus();
+    size_t coeff_modulus_size = coeff_modulus.size();
+    size_t w = params_.w;
+    size_t queries = ys.size();
 
-    begin = chrono::steady_clock::now();
-    cerr << "Lenc evaluation...\n";
-    Pointer<uint64_t> &delta = lenc.eval(temp);
-    cerr << "Lenc evaluation done in " << time_str(chrono::steady_clock::now() - begin) << ".\n";
+    if (sks.size() != queries || outs.size() != queries) {
+        throw invalid_argument("ys, sks and outs need to have the same length");
+    }
 
-    PolyIter res_iter(res.get(), poly_modulus_degree, coeff_modulus.size());
-    PolyIter delta_iter(delta.get(), poly_modulus_degree, coeff_modulus.size());
-    sub_poly_coeffmod(res_iter, delta_iter, w, coeff_modulus, res_iter);
+    // The digests are computed one after another (incrementally, where the ys are similar), and
+    // copied, as the digest of the next query replaces the tree in place. The digest cache is only
+    // written once, for the last query.
+    vector<Pointer<uint64_t>> digests(queries), trees(queries);
+    for (size_t q = 0; q < queries; ++q) {
+        digest(ys[q], false);
+        digests[q] = allocate_poly(poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
+        set_poly(lenc.data_digest_.get(), poly_modulus_degree, coeff_modulus_size, digests[q].get());
+        trees[q] = allocate_poly_array(lenc.tree_poly_count(), poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
+        set_poly_array(lenc.data_tree_.get(), lenc.tree_poly_count(), poly_modulus_degree, coeff_modulus_size, trees[q].get());
+    }
+    save_digest_cache();
+
+    vector<Pointer<uint64_t>> results(queries), deltas(queries);
+    vector<uint64_t *> digest_ptrs, sk_ptrs, tree_ptrs, result_ptrs, delta_ptrs;
+    for (size_t q = 0; q < queries; ++q) {
+        results[q] = allocate_poly_array(w, poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
+        deltas[q] = allocate_poly_array(w, poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
+        digest_ptrs.push_back(digests[q].get());
+        sk_ptrs.push_back(sks[q].get());
+        tree_ptrs.push_back(trees[q].get());
+        result_ptrs.push_back(results[q].get());
+        delta_ptrs.push_back(deltas[q].get());
+    }
 
-    MultiplyUIntModOperand inv = *context_data_.rns_tool()->base_q()->inv_punctured_prod_mod_base_array();
-    for (size_t i = 0; i < w; ++i) {
-        // Step 1: subtract the error from res_iter[i][0] (it is given in res_iter[i][1], but as a different modulus)
-        inverse_ntt_negacyclic_harvey(res_iter[i][1], context_data_.small_ntt_tables()[1]);
-        // Step 1b: Now we need to convert to a different modulus (this is relevant whenever some coefficient is negative!)
-        uint64_t modulus_value = coeff_modulus[1].value();
-        uint64_t modulus_value_plaintext = coeff_modulus[0].value();
-        SEAL_ITERATE(res_iter[i][1], poly_modulus_degree, [&](uint64_t &val) {
-            if (val > modulus_value/2) val = modulus_value_plaintext - (modulus_value - val);
+    // as in dec, the LHE decryption and the Lenc evaluation run at the same time
+    TaskGraph graph(*pool);
+    TaskGraph::Task lhe_task = graph.add([&] {
+        auto begin = chrono::steady_clock::now();
+        cerr << "LHE decryption of " + to_string(queries) + " queries...\n";
+        lhe.dec_many(digest_ptrs, sk_ptrs, result_ptrs);
+        cerr << "LHE decryption done in " + time_str(chrono::steady_clock::now() - begin) + ".\n";
+    });
+    TaskGraph::Task lenc_task = graph.add([&] {
+        auto begin = chrono::steady_clock::now();
+        cerr << "Lenc evaluation of " + to_string(queries) + " queries...\n";
+        lenc.eval_many(tree_ptrs, delta_ptrs);
+        cerr << "Lenc evaluation done in " + time_str(chrono::steady_clock::now() - begin) + ".\n";
+    });
+    graph.add([&] {
+        pool->parallel_for(queries*w, [&](size_t begin, size_t end) {
+            for (size_t k = begin; k < end; ++k) {
+                size_t q = k / w, i = k % w;
+                RNSIter res_iter = PolyIter(results[q].get(), poly_modulus_degree, coeff_modulus_size)[i];
+                RNSIter delta_iter = PolyIter(deltas[q].get(), poly_modulus_degree, coeff_modulus_size)[i];
+                sub_poly_coeffmod(res_iter, delta_iter, coeff_modulus_size, coeff_modulus, res_iter);
+                kernels_.decode(res_iter, outs[q].get() + i*poly_modulus_degree, context_data_);
+            }
         });
-        ntt_negacyclic_harvey(res_iter[i][1], context_data_.small_ntt_tables()[0]);
-        sub_poly_coeffmod(res_iter[i][0], res_iter[i][1], poly_modulus_degree, coeff_modulus[0], res_iter[i][0]);
-        // Step 2: remove the factor of Delta from res_iter[i][0] by multiplying with its inverse
-        multiply_poly_scalar_coeffmod(res_iter[i][0], poly_modulus_degree, inv, coeff_modulus[0], res_iter[i][0]);
-        // Step 3: copy output
-        set_uint(res_iter[i], poly_modulus_degree, out.get() + i*poly_modulus_degree);
-    }
-}
\ No newline at end of file
+    }, { lhe_task, lenc_task });
+    graph.run();
+}
+
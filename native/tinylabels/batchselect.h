@@ -1,16 +1,27 @@
 #pragma once
 
+#include "container.h"
+#include "kernels.h"
+#include "labels.h"
+#include "mappedfile.h"
+#include "packing.h"
+#include "params.h"
+#include "threadpool.h"
 #include "seal/seal.h"
-#include "seal/util/clipnormal.h"
+#include "seal/util/blake2.h"
 #include "seal/util/iterator.h"
 #include "seal/util/polyarithsmallmod.h"
 
 #include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <cstddef>
+#include <cstring>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
+#include <map>
 #include <limits>
 #include <memory>
 #include <mutex>
@@ -25,34 +36,69 @@ using namespace std;
 using namespace seal;
 using namespace seal::util;
 
-const size_t mod_plaintext = 50;
-const size_t mod_noise = 59;
+/**
+The discrete Gaussian distribution over the integers with the given standard deviation, i.e.,
+P(x) proportional to exp(-x^2/(2 sigma^2)), restricted to |x| <= max_deviation. It is sampled
+with a cumulative distribution table (CDT) of |x| with 63-bit precision, taking one word of
+randomness per sample; a guide table indexed by the top bits of the random word leaves only a
+few (usually no) entries of the CDT to check, for any standard deviation.
+*/
+struct DiscreteGaussian {
+public:
 
-const size_t poly_modulus_degree = 4096;
-const size_t w = 512;  // needs to be a power of 2
-const size_t l = 9;    // = log_2 w
-const size_t m = 4;    // s.t. g^m > modulus
-const uint64_t g = (uint64_t)1 << 28;
+    DiscreteGaussian(double standard_deviation, double max_deviation);
 
-const size_t poly_size = 2*poly_modulus_degree;
+    // Writes a polynomial of samples (in coefficient form, modulo every prime of parms) to destination.
+    void sample_poly(UniformRandomGenerator &prng, const EncryptionParameters &parms, uint64_t *destination) const;
 
-constexpr double noise_small_standard_deviation = 4;
-constexpr double noise_small_max_deviation = 128 * noise_small_standard_deviation;
+//private:
+    static constexpr int max_guide_bits = 16;
 
-constexpr double noise_large_standard_deviation = 1000;
-constexpr double noise_large_max_deviation = 128 * noise_large_standard_deviation;
+    vector<uint64_t> cdt_; // cdt_[k] = 2^63 * P(|x| <= k)
+    int guide_bits_;
+    vector<uint32_t> guide_; // guide_[p] = |x| for the smallest random value with the top bits p
+};
 
-void sample_poly_normal(
-    shared_ptr<UniformRandomGenerator> prng, const EncryptionParameters &parms, uint64_t *destination,
-    double noise_standard_deviation, double noise_max_deviation);
+// Creates the PRNG for stream number stream, derived deterministically from seed.
+shared_ptr<UniformRandomGenerator> derive_prng(const prng_seed_type &seed, uint64_t stream);
+// Same, for a PRNG of the type given by info, derived from the seed of info.
+shared_ptr<UniformRandomGenerator> derive_prng(const UniformRandomGeneratorInfo &info, uint64_t stream);
 
+// Adds noise (in NTT form) to count polynomials. Uses one seed from prng, from which an independent
+// stream is derived for each polynomial; the result is the same for any number of threads in pool.
 void add_poly_error(
     size_t count,
     shared_ptr<UniformRandomGenerator> prng, const SEALContext::ContextData &context_data, uint64_t *destination,
-    double noise_standard_deviation, double noise_max_deviation);
+    double noise_standard_deviation, double noise_max_deviation, ThreadPool &pool);
+// Same, for the count polynomials starting at polynomial first of an array, whose noise is derived
+// from seed; adding noise to the array in several parts gives the same result as all at once.
+void add_poly_error(
+    const prng_seed_type &seed, size_t first, size_t count, const SEALContext::ContextData &context_data,
+    uint64_t *destination, double noise_standard_deviation, double noise_max_deviation, ThreadPool &pool);
 
+// Samples a uniform polynomial; rejection sampling on blocks of words, with a spare block per residue array (see the definition).
 void sample_poly_uniform(
     shared_ptr<UniformRandomGenerator> prng, const EncryptionParameters &parms, uint64_t *destination);
+// Samples count uniform polynomials in parallel, each from its own stream derived from one seed of prng (see add_poly_error).
+void sample_poly_array_uniform(
+    size_t count, shared_ptr<UniformRandomGenerator> prng, const EncryptionParameters &parms, uint64_t *destination,
+    ThreadPool &pool);
+
+/**
+The public parameters are uniform polynomials, so instead of storing them, pp.bin may store the
+seed from which they are derived (in "seeded" form, polynomial i is sampled from derive_prng(info, i)).
+A seed is written as a marker word, which is larger than any coefficient, followed by the serialized
+UniformRandomGeneratorInfo. read_seed returns false, and does not consume anything, if the next
+word of f is not the marker (i.e., if the polynomials are stored in full). The marker also gives the
+version of the expansion: seeds of the first version (expanded before sample_poly_uniform drew its
+words in blocks) are rejected with a runtime_error, as they would give other polynomials.
+*/
+void save_seed(FILE* f, const UniformRandomGeneratorInfo &info);
+bool read_seed(FILE* f, UniformRandomGeneratorInfo &info);
+// Same as read_seed, from the memory range [in, in + size); returns the number of bytes read (0 if there is no marker).
+size_t read_seed(const uint8_t *in, size_t size, UniformRandomGeneratorInfo &info);
+// Draws a fresh seed from prng, for a PRNG of the same type as prng.
+UniformRandomGeneratorInfo sample_seed(shared_ptr<UniformRandomGenerator> prng);
 
 string time_str(chrono::nanoseconds time);
 void print_statistics();
@@ -60,65 +106,109 @@ void print_statistics();
 struct LHE {
 public:
 
-    LHE(const SEALContext::ContextData &context_data, shared_ptr<UniformRandomGenerator> prng) : context_data_(context_data), prng(prng) {}
+    LHE(const BatchSelectParams &params, const SEALContext::ContextData &context_data, shared_ptr<UniformRandomGenerator> prng, shared_ptr<ThreadPool> pool = make_shared<ThreadPool>()) : params_(params), context_data_(context_data), kernels_(select_kernels(context_data)), prng(prng), pool(pool) {}
 
     void setup();
-    void save_pp(FILE* f) {
-        fwrite(data_a_.get(), 8, w*poly_size, f);
-    }
-    void read_pp(FILE* f) {
-        data_a_ = allocate_poly_array(w, poly_modulus_degree, context_data_.parms().coeff_modulus().size(), MemoryManager::GetPool());
-        fread(data_a_.get(), 8, w*poly_size, f);
-    }
+    // seeded = false writes all polynomials of a
+    void save_pp(FILE* f, bool seeded = true);
+    void read_pp(FILE* f);
+    // Same as read_pp, for the data of file starting at offset; offset is advanced past the data.
+    // If the polynomials are stored in full, they are used in place.
+    void map_pp(shared_ptr<MappedFile> file, size_t &offset);
 
     void enc1(Pointer<uint64_t> &m1);
-    void save_st1(FILE* f) {
-        fwrite(data_s1_.get(), 8, m*poly_size, f);
+    // Same, drawing s1 and the noise from random instead of prng.
+    void enc1(Pointer<uint64_t> &m1, shared_ptr<UniformRandomGenerator> random);
+    void save_st1(FILE* f, bool packed = false) {
+        save_polys(f, data_s1_.get(), params_.m, poly_format(), packed, *pool);
     }
     void read_st1(FILE* f) {
-        data_s1_ = allocate_poly_array(m, poly_modulus_degree, context_data_.parms().coeff_modulus().size(), MemoryManager::GetPool());
-        fread(data_s1_.get(), 8, m*poly_size, f);
+        data_s1_ = allocate_poly_array(params_.m, params_.poly_modulus_degree, coeff_modulus_size(), MemoryManager::GetPool());
+        read_polys(f, data_s1_.get(), params_.m, poly_format(), *pool);
     }
-    void save_ct1(FILE* f) {
-        fwrite(data_ct1_.get(), 8, w*m*poly_size, f);
+    void save_ct1(FILE* f, bool packed = false) {
+        save_polys(f, data_ct1_.get(), params_.w*params_.m, poly_format(), packed, *pool);
     }
     void read_ct1(FILE* f) {
-        data_ct1_ = allocate_poly_array(w*m, poly_modulus_degree, context_data_.parms().coeff_modulus().size(), MemoryManager::GetPool());
-        fread(data_ct1_.get(), 8, w*m*poly_size, f);
+        data_ct1_ = allocate_poly_array(params_.w*params_.m, params_.poly_modulus_degree, coeff_modulus_size(), MemoryManager::GetPool());
+        read_polys(f, data_ct1_.get(), params_.w*params_.m, poly_format(), *pool);
     }
+    // uses the ciphertext in place (see map_pp)
+    void map_ct1(shared_ptr<MappedFile> file, size_t &offset);
 
     void enc2(Pointer<uint64_t> &m2);
-    void save_st2(FILE* f) {
-        fwrite(data_s2_.get(), 8, poly_size, f);
+    void save_st2(FILE* f, bool packed = false) {
+        save_polys(f, data_s2_.get(), 1, poly_format(), packed, *pool);
     }
     void read_st2(FILE* f) {
-        data_s2_ = allocate_poly(poly_modulus_degree, context_data_.parms().coeff_modulus().size(), MemoryManager::GetPool());
-        fread(data_s2_.get(), 8, poly_size, f);
+        data_s2_ = allocate_poly(params_.poly_modulus_degree, coeff_modulus_size(), MemoryManager::GetPool());
+        read_polys(f, data_s2_.get(), 1, poly_format(), *pool);
     }
-    void save_ct2(FILE* f) {
-        fwrite(data_ct2_.get(), 8, w*poly_size, f);
+    void save_ct2(FILE* f, bool packed = false) {
+        save_polys(f, data_ct2_.get(), params_.w, poly_format(), packed, *pool);
     }
     void read_ct2(FILE* f) {
-        data_ct2_ = allocate_poly_array(w, poly_modulus_degree, context_data_.parms().coeff_modulus().size(), MemoryManager::GetPool());
-        fread(data_ct2_.get(), 8, w*poly_size, f);
+        data_ct2_ = allocate_poly_array(params_.w, params_.poly_modulus_degree, coeff_modulus_size(), MemoryManager::GetPool());
+        read_polys(f, data_ct2_.get(), params_.w, poly_format(), *pool);
     }
 
     void keygen(Pointer<uint64_t> &y);
-    void save_sk(FILE* f) {
-        fwrite(data_sk_.get(), 8, poly_size, f);
+    void save_sk(FILE* f, bool packed = false) {
+        save_polys(f, data_sk_.get(), 1, poly_format(), packed, *pool);
     }
     void read_sk(FILE* f) {
-        data_sk_ = allocate_poly(poly_modulus_degree, context_data_.parms().coeff_modulus().size(), MemoryManager::GetPool());
-        fread(data_sk_.get(), 8, poly_size, f);
+        data_sk_ = allocate_poly(params_.poly_modulus_degree, coeff_modulus_size(), MemoryManager::GetPool());
+        read_polys(f, data_sk_.get(), 1, poly_format(), *pool);
     }
 
     Pointer<uint64_t>& dec(Pointer<uint64_t> &y);
+    // Same as dec for several digests ys[q] and keys sks[q] at once, into results[q] (w polynomials each).
+    void dec_many(const vector<uint64_t *> &ys, const vector<uint64_t *> &sks, const vector<uint64_t *> &results);
+    /**
+    The steps of dec_many: decompose_ys returns the gadget decompositions of the ys (m polynomials
+    each), prepare_sks prepares the keys for the products with a, and dec_blocks decrypts only the
+    blocks first, ..., first + count - 1, into results[q] (count polynomials each).
+    */
+    Pointer<uint64_t> decompose_ys(const vector<uint64_t *> &ys);
+    vector<PreparedPolys> prepare_sks(const vector<uint64_t *> &sks);
+    void dec_blocks(const uint64_t *ys_decomposed, const vector<PreparedPolys> &sks, size_t first, size_t count, const vector<uint64_t *> &results);
+    // Drops the blocks of ct1 from memory if ct1 was mapped (see MappedFile::dont_need).
+    void release_blocks(size_t first, size_t count);
 
 //private:
+    // Returns a[i], either from data_a_, or regenerated from the seed into temp (one polynomial).
+    RNSIter a_block(size_t i, uint64_t *temp) const;
+
+    size_t coeff_modulus_size() const {
+        return context_data_.parms().coeff_modulus().size();
+    }
+    // number of words of one polynomial
+    size_t poly_size() const {
+        return params_.poly_modulus_degree * coeff_modulus_size();
+    }
+    PolyFormat poly_format() const {
+        return PolyFormat(params_.poly_modulus_degree, context_data_.parms().coeff_modulus());
+    }
+    // If file contains count packed polynomials at offset, unpacks them into data and advances offset.
+    bool map_packed(const MappedFile &file, size_t &offset, Pointer<uint64_t> &data, size_t count) {
+        if (!is_packed(file.data() + offset, file.size() - offset)) return false;
+        data = allocate_poly_array(count, params_.poly_modulus_degree, coeff_modulus_size(), MemoryManager::GetPool());
+        offset += unpack_polys(file.data() + offset, file.size() - offset, data.get(), count, poly_format(), *pool);
+        return true;
+    }
+
+    const BatchSelectParams params_;
     const SEALContext::ContextData &context_data_;
+    const KernelTable &kernels_;
     shared_ptr<UniformRandomGenerator> prng;
+    shared_ptr<ThreadPool> pool;
+
+    UniformRandomGeneratorInfo a_info_;
+    Pointer<uint64_t> data_a_; // only set if a was read in full
 
-    Pointer<uint64_t> data_a_;
+    // the files that data_a_ and data_ct1_ point into, if they were mapped
+    shared_ptr<MappedFile> pp_file_;
+    shared_ptr<MappedFile> ct1_file_;
 
     Pointer<uint64_t> data_s1_;
     Pointer<uint64_t> data_s2_;
@@ -130,45 +220,143 @@ public:
     Pointer<uint64_t> data_mres_;
 };
 
+/**
+Order of the blocks of the Lenc ciphertext, which has a block of 2m polynomials for every leaf
+on every level. In level-major layout, the w blocks of each level are contiguous; in leaf-major
+layout, the l blocks of each leaf are contiguous, so that eval (which goes through the leaves)
+reads the ciphertext sequentially.
+*/
+enum class CtLayout {
+    level_major,
+    leaf_major
+};
+
 struct Lenc {
 public:
 
-    Lenc(const SEALContext::ContextData &context_data, shared_ptr<UniformRandomGenerator> prng) : context_data_(context_data), prng(prng) {}
+    Lenc(const BatchSelectParams &params, const SEALContext::ContextData &context_data, shared_ptr<UniformRandomGenerator> prng, shared_ptr<ThreadPool> pool = make_shared<ThreadPool>()) : params_(params), context_data_(context_data), kernels_(select_kernels(context_data)), prng(prng), pool(pool) {}
+    Lenc(const BatchSelectParams &params, const SEALContext::ContextData &context_data, shared_ptr<UniformRandomGenerator> prng, size_t threads) : Lenc(params, context_data, prng, make_shared<ThreadPool>(threads)) {}
 
     void setup();
-    void save_pp(FILE* f) {
-        fwrite(data_b_.get(), 8, 2*m*poly_size, f);
-    }
-    void read_pp(FILE* f) {
-        data_b_ = allocate_poly_array(2*m, poly_modulus_degree, context_data_.parms().coeff_modulus().size(), MemoryManager::GetPool());
-        fread(data_b_.get(), 8, 2*m*poly_size, f);
-    }
+    // seeded = false writes all polynomials of b
+    void save_pp(FILE* f, bool seeded = true);
+    void read_pp(FILE* f);
+    // Same as read_pp, for the data of file starting at offset; offset is advanced past the data.
+    void map_pp(shared_ptr<MappedFile> file, size_t &offset);
 
     Pointer<uint64_t>& enc(Pointer<uint64_t> &s);
-    void save_ct1(FILE* f) {
-        fwrite(data_ct_.get(), 8, l*w*2*m*poly_size, f);
+    // The two steps of enc: sample_r generates (and returns) r, and enc_ct computes ct from r and s,
+    // drawing the noise from random (which enc takes to be prng).
+    Pointer<uint64_t>& sample_r();
+    void enc_ct(Pointer<uint64_t> &s, shared_ptr<UniformRandomGenerator> random);
+    /**
+    Same as enc_ct, but hands ct to writer in batches of whole blocks (in the order of the layout)
+    as they are computed, instead of keeping it in memory; the result is the same as saving the
+    ct of enc_ct with save_ct1. writer needs to be set up for ct_poly_count() polynomials, and for
+    batches of at least one block of 2m polynomials.
+    */
+    void enc_ct(Pointer<uint64_t> &s, shared_ptr<UniformRandomGenerator> random, AsyncPolyWriter &writer);
+    void save_ct1(FILE* f, bool packed = false) {
+        save_polys(f, data_ct_.get(), ct_poly_count(), poly_format(), packed, *pool);
     }
     void read_ct1(FILE* f) {
-        data_ct_ = allocate_poly_array(l*w*2*m, poly_modulus_degree, context_data_.parms().coeff_modulus().size(), MemoryManager::GetPool());
-        fread(data_ct_.get(), 8, l*w*2*m*poly_size, f);
+        data_ct_ = allocate_poly_array(ct_poly_count(), params_.poly_modulus_degree, coeff_modulus_size(), MemoryManager::GetPool());
+        read_polys(f, data_ct_.get(), ct_poly_count(), poly_format(), *pool);
     }
+    // uses the ciphertext in place (see LHE::map_pp)
+    void map_ct1(shared_ptr<MappedFile> file, size_t &offset);
 
     Pointer<uint64_t>& digest(Pointer<uint64_t> &a);
-
-    Pointer<uint64_t>& eval(Pointer<uint64_t> &a);
+    void digest_nodes(size_t first, size_t count, uint64_t *temp);
+    // number of nodes that digest computes together (and decomposes in one batch)
+    static constexpr size_t node_batch = 16;
+    // Stores the digest and the decomposed tree; they are only cached locally, so they are not packed.
+    void save_digest(FILE* f) {
+        save_polys(f, data_digest_.get(), 1, poly_format(), false, *pool);
+        save_polys(f, data_tree_.get(), tree_poly_count(), poly_format(), false, *pool);
+    }
+    // uses the digest and the tree in place (see LHE::map_pp)
+    void map_digest(shared_ptr<MappedFile> file, size_t &offset);
+
+    // evaluates the ciphertext at the tree of the last digest
+    Pointer<uint64_t>& eval();
+    // Same as eval for several trees at once, into deltas[q] (w polynomials each), with a single pass over the ciphertext.
+    void eval_many(const vector<uint64_t *> &trees, const vector<uint64_t *> &deltas);
+    // eval_many for the leaves first, ..., first + count - 1 only, into deltas[q] (count polynomials each)
+    void eval_leaves(const vector<uint64_t *> &trees, size_t first, size_t count, const vector<uint64_t *> &deltas);
+    // Drops the ciphertext blocks of the leaves from memory if ct was mapped (see MappedFile::dont_need).
+    void release_leaves(size_t first, size_t count);
+
+    /**
+    Incremental versions of digest and eval. update_digest takes leaves a that differ from the
+    current leaves only at the indices in changed_leaves (the other leaves of a are not read), and
+    only recomputes these leaves and their ancestors. update_eval corrects the result of the last
+    eval by the terms of the nodes that changed since, instead of evaluating all w*l terms again;
+    it needs the tree to have been updated only by update_digest since that eval (see can_update_eval).
+    */
+    Pointer<uint64_t>& update_digest(Pointer<uint64_t> &a, const vector<size_t> &changed_leaves);
+    Pointer<uint64_t>& update_eval();
+    bool can_update_eval() const {
+        return data_delta_ && !tree_rebuilt_;
+    }
 
 //private:
+    // regenerates data_b_ from b_info_
+    void expand_b();
+
+    size_t coeff_modulus_size() const {
+        return context_data_.parms().coeff_modulus().size();
+    }
+    // number of words of one polynomial
+    size_t poly_size() const {
+        return params_.poly_modulus_degree * coeff_modulus_size();
+    }
+    PolyFormat poly_format() const {
+        return PolyFormat(params_.poly_modulus_degree, context_data_.parms().coeff_modulus());
+    }
+    // If file contains count packed polynomials at offset, unpacks them into data and advances offset.
+    bool map_packed(const MappedFile &file, size_t &offset, Pointer<uint64_t> &data, size_t count) {
+        if (!is_packed(file.data() + offset, file.size() - offset)) return false;
+        data = allocate_poly_array(count, params_.poly_modulus_degree, coeff_modulus_size(), MemoryManager::GetPool());
+        offset += unpack_polys(file.data() + offset, file.size() - offset, data.get(), count, poly_format(), *pool);
+        return true;
+    }
+    // number of polynomials of the ciphertext
+    size_t ct_poly_count() const {
+        return params_.l()*params_.w*2*params_.m;
+    }
+    // Computes the count ciphertext blocks (without noise) starting at block first of the layout into destination.
+    void enc_blocks(size_t first, size_t count, const PreparedPolys &b, const uint64_t *s, uint64_t *destination);
+
+    // index of the first polynomial of the ciphertext block of leaf i on level j
+    size_t ct_block(size_t i, size_t j) const {
+        return (ct_layout_ == CtLayout::leaf_major ? i*params_.l() + j : j*params_.w + i)*2*params_.m;
+    }
+    // number of polynomials of the decomposed tree
+    size_t tree_poly_count() const {
+        return (2*params_.w - 1)*params_.m;
+    }
+
+    const BatchSelectParams params_;
     const SEALContext::ContextData &context_data_;
+    const KernelTable &kernels_;
     shared_ptr<UniformRandomGenerator> prng;
+    shared_ptr<ThreadPool> pool;
 
-    Pointer<uint64_t> data_b_;
+    UniformRandomGeneratorInfo b_info_;
+    Pointer<uint64_t> data_b_; // always expanded, as b only consists of 2m polynomials
 
     Pointer<uint64_t> data_r_;
 
     Pointer<uint64_t> data_ct_;
+    CtLayout ct_layout_ = CtLayout::level_major;
+    shared_ptr<MappedFile> ct_file_; // the file that data_ct_ points into, if it was mapped
 
     Pointer<uint64_t> data_tree_; // in decomposed form!
     Pointer<uint64_t> data_digest_;
+    shared_ptr<MappedFile> digest_file_; // the file that data_tree_ and data_digest_ point into, if they were loaded from a cache
+    bool tree_rebuilt_ = false; // whether the tree was replaced since the last eval
+    map<size_t, Pointer<uint64_t>> eval_base_; // the nodes changed by update_digest since the last eval, with their values at that time
 
     Pointer<uint64_t> data_delta_;
 
@@ -177,63 +365,120 @@ public:
 struct BatchSelect {
 public:
 
-    BatchSelect(const SEALContext::ContextData &context_data, shared_ptr<UniformRandomGenerator> prng) : context_data_(context_data), prng(prng), lhe(context_data, prng), lenc(context_data, prng) {}
+    // threads is the total number of threads used by the LHE and Lenc operations (1 = single-threaded)
+    BatchSelect(const BatchSelectParams &params, const SEALContext::ContextData &context_data, shared_ptr<UniformRandomGenerator> prng, size_t threads = 1) : params_(params), context_data_(context_data), kernels_(select_kernels(context_data)), prng(prng), pool(make_shared<ThreadPool>(threads)), lhe(params, context_data, prng, pool), lenc(params, context_data, prng, pool) {}
 
     void setup();
-    void save_pp(FILE* f) {
-        lhe.save_pp(f);
-        lenc.save_pp(f);
-    }
-    void read_pp(FILE* f) {
-        lhe.read_pp(f);
-        lenc.read_pp(f);
-    }
-
-    void enc1(Pointer<uint64_t> &l1);
-    void save_st1(FILE* f) {
-        lhe.save_st1(f);
-    }
-    void save_ct1(FILE* f) {
-        lhe.save_ct1(f);
-        lenc.save_ct1(f);
-    }
-    void read_st1(FILE* f) {
-        lhe.read_st1(f);
-    }
-    void read_ct1(FILE* f) {
-        lhe.read_ct1(f);
-        lenc.read_ct1(f);
-    }
+    /**
+    The files are containers (see container.h), with the LHE and Lenc parts in the sections "LHE"
+    and "LENC". Reading throws std::runtime_error if a file was created for other parameters or
+    is corrupted. By default, only the seeds of the public parameters are stored (see save_seed).
+    */
+    void save_pp(FILE* f, bool seeded = true);
+    void read_pp(FILE* f);
+    // Maps the file instead of reading it; the chunk checksums are not verified (see ContainerReader).
+    void map_pp(const string &path);
+
+    // layout of the Lenc ciphertext computed by enc1; read_ct1 and map_ct1 set it to the layout of the file
+    CtLayout ct_layout = CtLayout::level_major;
+    void enc1(Pointer<uint64_t> &l1); // l1 needs to have params.label_count() entries
+    /**
+    enc1 followed by save_ct1(f, packed), where the Lenc ciphertext is written while it is computed
+    (see Lenc::enc_ct), by a writer thread in batches of window blocks (of 2m polynomials each). Only
+    two batches of it are in memory at any time, instead of l*w blocks. The Lenc section precedes
+    the LHE section in the file, which is written after the LHE encryption that runs meanwhile.
+    */
+    void enc1(Pointer<uint64_t> &l1, FILE* f, bool packed, size_t window);
+    void save_st1(FILE* f, bool packed = false);
+    void save_ct1(FILE* f, bool packed = false);
+    void read_st1(FILE* f);
+    void read_ct1(FILE* f);
+    // Maps the file instead of reading it, so that loading is almost instant and the pages of the
+    // file are shared between processes.
+    void map_ct1(const string &path);
 
     void enc2(Pointer<uint64_t> &l2);
-    void save_st2(FILE* f) {
-        lhe.save_st2(f);
-    }
-    void read_st2(FILE* f) {
-        lhe.read_st2(f);
-    }
-    void save_ct2(FILE* f) {
-        lhe.save_ct2(f);
-    }
-    void read_ct2(FILE* f) {
-        lhe.read_ct2(f);
-    }
+    void save_st2(FILE* f, bool packed = false);
+    void read_st2(FILE* f);
+    void save_ct2(FILE* f, bool packed = false);
+    void read_ct2(FILE* f);
 
-    void keygen(Pointer<uint64_t> &y);
-    void save_sk(FILE* f) {
-        lhe.save_sk(f);
-    }
-    void read_sk(FILE* f) {
-        lhe.read_sk(f);
-    }
+    // save_cache as for digest
+    void keygen(Pointer<uint64_t> &y, bool save_cache = true);
+    void save_sk(FILE* f, bool packed = false);
+    void read_sk(FILE* f);
 
     void dec(Pointer<uint64_t> &y, Pointer<uint64_t> &out);
 
+    // receives the labels of the blocks first, ..., first + count - 1 (count*N labels)
+    using LabelSink = function<void(size_t first, size_t count, const uint64_t *labels)>;
+    /**
+    dec in slices of slice blocks. After the digest, the LHE decryption, the Lenc evaluation and the
+    decoding are done for one slice of blocks at a time, and each slice is passed to sink (on the
+    calling thread) as soon as it is decoded. Besides the digest with its tree, the memory used is
+    proportional to slice instead of w. The result of the last eval is kept, so that a later dec
+    can still update it (see Lenc::update_eval).
+    */
+    void dec(Pointer<uint64_t> &y, size_t slice, const LabelSink &sink);
+
+    /**
+    keygen and dec for several choice vectors. keygen_many stores the key of ys[q] in sks[q].
+    dec_many decrypts for ys[q] with the key sks[q] into outs[q] (params.label_count() entries
+    each), in one pass over ct1: every block of the ciphertexts is used for all queries while it
+    is in cache, so that ct1 is read from memory (or disk) once instead of once per query. It
+    needs one decomposed tree per query in memory ((2w-1)*m polynomials each).
+    */
+    void keygen_many(vector<Pointer<uint64_t>> &ys, vector<Pointer<uint64_t>> &sks);
+    void dec_many(vector<Pointer<uint64_t>> &ys, vector<Pointer<uint64_t>> &sks, vector<Pointer<uint64_t>> &outs);
+    // a copy of the current key (of the last keygen or read_sk), and replacing it (e.g., for save_sk)
+    Pointer<uint64_t> sk() const;
+    void set_sk(const Pointer<uint64_t> &sk);
+
+    /**
+    If digest_cache is set, keygen and dec store the Lenc digest of y (with the decomposed tree)
+    in that file, and load it instead of recomputing it if the file was created for the same y
+    and public parameters. A cache that does not match, or cannot be read, is recomputed and
+    replaced; as the digest only depends on y and b, one cache can be shared by keygen and dec.
+    */
+    string digest_cache;
+    /**
+    Lenc digest of y. If there already is a digest for a y that differs only in some blocks
+    (y[i*N], ..., y[(i+1)*N-1] for a block i), in memory or in digest_cache, only the parts for
+    these blocks are recomputed (see Lenc::update_digest); repeated calls of dec then also only
+    update the Lenc evaluation. With save_cache = false, a new digest is not written to
+    digest_cache until the next save_digest_cache (as keygen_many and dec_many do once, after
+    the last query).
+    */
+    Pointer<uint64_t>& digest(Pointer<uint64_t> &y, bool save_cache = true);
+    // writes the current digest to digest_cache if it is newer than the cache
+    void save_digest_cache();
+    // y as polynomials in NTT form modulo the second modulus, as taken by Lenc::digest; only the given blocks are set
+    Pointer<uint64_t> encode_y(Pointer<uint64_t> &y, const vector<size_t> &blocks);
+    Pointer<uint64_t> encode_y(Pointer<uint64_t> &y);
+    vector<uint64_t> y_bitset(Pointer<uint64_t> &y) const;
+    // the blocks in which the bitsets a and b (each of w*N bits) differ
+    vector<size_t> changed_blocks(const uint64_t *a, const uint64_t *b) const;
+    // hash of b, which the digest depends on besides y
+    ParamsHash b_hash() const;
+    // Maps the cache if it was created for b_key; changed is set to the blocks in which y_bits differs from its y.
+    bool load_digest(const string &path, const ParamsHash &b_key, const vector<uint64_t> &y_bits, vector<size_t> &changed);
+    void save_digest(const string &path, const ParamsHash &b_key, const vector<uint64_t> &y_bits);
+    // tag of the section of ct1 that holds the Lenc ciphertext in the given layout
+    static const char *ct_section(CtLayout layout);
+    // updates the digest for the changed blocks of y
+    Pointer<uint64_t>& update_digest(Pointer<uint64_t> &y, const vector<size_t> &changed);
+
 //private:
+    const BatchSelectParams params_;
     const SEALContext::ContextData &context_data_;
+    const KernelTable &kernels_;
     shared_ptr<UniformRandomGenerator> prng;
+    shared_ptr<ThreadPool> pool;
 
     LHE lhe;
     Lenc lenc;
 
+    vector<uint64_t> digest_y_; // y of the current Lenc digest, as a bitset (empty if there is none)
+    bool digest_unsaved_ = false; // whether the current digest still needs to be written to digest_cache
+
 };
\ No newline at end of file
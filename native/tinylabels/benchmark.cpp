@@ -4,15 +4,15 @@ using namespace std;
 using namespace seal;
 using namespace seal::util;
 
-int main()
+int main(int argc, char **argv)
 {
-    EncryptionParameters parms(scheme_type::onoff);
-    parms.set_poly_modulus_degree(poly_modulus_degree);
-    parms.set_plain_modulus(PlainModulus::Batching(poly_modulus_degree, mod_plaintext));
+    Options options = parse_options(argc, argv);
+    const BatchSelectParams &params = options.params;
 
-    vector<Modulus> coeff_modulus = CoeffModulus::Create(poly_modulus_degree, {mod_noise});
-    coeff_modulus.insert(coeff_modulus.begin(), parms.plain_modulus());
-    parms.set_coeff_modulus(coeff_modulus);
+    EncryptionParameters parms = params.encryption_parameters();
+    const vector<Modulus> &coeff_modulus = parms.coeff_modulus();
+    size_t poly_modulus_degree = params.poly_modulus_degree;
+    size_t m = params.m;
 
     cout << "moduli: " << coeff_modulus[0].value() << " " << coeff_modulus[1].value() << "\n";
 
@@ -52,6 +52,12 @@ int main()
     }
     cerr << "10000 mult's done in " <<time_str(chrono::steady_clock::now() - begin) << ".\n";
 
+    begin = chrono::steady_clock::now();
+    for (size_t i = 0; i < 5000/(2*m); ++i) {
+        dyadic_product_accumulate(a_iter + i*2*m, b_iter + i*2*m, 2*m, coeff_modulus, c_iter[i]);
+    }
+    cerr << 5000/(2*m) << " inner products of length " << 2*m << " (10000 fused mult's) done in " << time_str(chrono::steady_clock::now() - begin) << ".\n";
+
     begin = chrono::steady_clock::now();
     for (size_t i = 0; i < 5000; ++i) {
         multiply_poly_scalar_coeffmod(a_iter[i], coeff_modulus.size(), i, coeff_modulus, c_iter[i]);
@@ -76,6 +82,62 @@ int main()
     }
     cerr << "10000 inverse NTT's done in " << time_str(chrono::steady_clock::now() - begin) << ".\n";
 
+    // the BatchSelect kernels, generic and (if available) specialized for the parameters
+    const KernelTable &selected_kernels = select_kernels(context_data);
+    // as the b of Lenc, the second operand of the outer products is prepared once
+    PreparedPolys b_prepared(b_iter, 2*m, coeff_modulus);
+    for (const KernelTable *kernels : { &GenericKernels::table(), &selected_kernels }) {
+        cerr << "Kernels " << kernels->name << ":\n";
+
+        begin = chrono::steady_clock::now();
+        for (size_t i = 0; i < 5000/(2*m); ++i) {
+            kernels->outer_product(a_iter + i, 1, b_prepared, c_iter + i*2*m, coeff_modulus);
+        }
+        cerr << "  " << 5000/(2*m) << " outer products of length " << 2*m << " done in " << time_str(chrono::steady_clock::now() - begin) << ".\n";
+
+        begin = chrono::steady_clock::now();
+        for (size_t i = 0; i < 5000/(2*m); ++i) {
+            kernels->inner_product(a_iter + i*2*m, b_iter + i*2*m, 2*m, c_iter[i], coeff_modulus);
+        }
+        cerr << "  " << 5000/(2*m) << " inner products of length " << 2*m << " done in " << time_str(chrono::steady_clock::now() - begin) << ".\n";
+
+        begin = chrono::steady_clock::now();
+        for (size_t i = 0; i < 5000/m; ++i) {
+            kernels->multiply_g(a_iter[i], c_iter + i*m, params, context_data);
+        }
+        cerr << "  " << 5000/m << " multiplications by the gadget vector done in " << time_str(chrono::steady_clock::now() - begin) << ".\n";
+
+        begin = chrono::steady_clock::now();
+        kernels->decompose_g(a_iter, 5000/m, c_iter, params, context_data);
+        cerr << "  " << 5000/m << " gadget decompositions (in one batch) done in " << time_str(chrono::steady_clock::now() - begin) << ".\n";
+    }
+
+    // enc1 runs its phases concurrently; with a fixed seed, ct1 (and the Lenc ciphertext) must not
+    // depend on the number of threads
+    {
+        BatchSelectParams small = params;
+        small.w = 16;
+        size_t threads = max<size_t>(options.threads, 4);
+        cerr << "Checking that enc1 gives the same ciphertexts with 1 and " << threads << " threads:\n";
+
+        auto enc1_with = [&](size_t threads) {
+            prng_seed_type seed{};
+            BatchSelect bs(small, context_data, Blake2xbPRNGFactory(seed).create(), threads);
+            bs.setup();
+            Pointer<uint64_t> l1 = allocate_zero_uint(small.label_count(), MemoryManager::GetPool());
+            bs.enc1(l1);
+            size_t ct1_words = small.w*small.m*bs.lhe.poly_size(), ct_words = bs.lenc.ct_poly_count()*bs.lenc.poly_size();
+            vector<uint64_t> result(bs.lhe.data_ct1_.get(), bs.lhe.data_ct1_.get() + ct1_words);
+            result.insert(result.end(), bs.lenc.data_ct_.get(), bs.lenc.data_ct_.get() + ct_words);
+            return result;
+        };
+        if (enc1_with(1) != enc1_with(threads)) {
+            cerr << "  the ciphertexts differ.\n";
+            return 1;
+        }
+        cerr << "  ok.\n";
+    }
+
     print_statistics();
 
     return 0;
@@ -0,0 +1,369 @@
+// 64-bit off_t for fseeko and ftello also on 32-bit systems; needs to come before any system header
+#ifndef _FILE_OFFSET_BITS
+#define _FILE_OFFSET_BITS 64
+#endif
+
+#include "container.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#endif
+
+using namespace std;
+using namespace seal;
+using namespace seal::util;
+
+namespace {
+
+// "TLCONT01" in little endian
+constexpr uint64_t container_magic = 0x3130544e4f434c54;
+
+// magic, version, kind, hash (4 words), chunk size, section count, header checksum
+constexpr size_t header_words = 10;
+constexpr size_t checksum_index = header_words - 1;
+constexpr size_t section_words = 4;
+
+// File positions as 64-bit offsets; fseek and ftell take a long, which has 32 bits on some
+// platforms, so that containers larger than 2 GB could not be read or written there.
+int64_t tell(FILE* f) {
+#ifdef _WIN32
+    return _ftelli64(f);
+#else
+    return static_cast<int64_t>(ftello(f));
+#endif
+}
+
+void seek(FILE* f, int64_t offset, int origin) {
+#ifdef _WIN32
+    _fseeki64(f, offset, origin);
+#else
+    fseeko(f, static_cast<off_t>(offset), origin);
+#endif
+}
+
+// upper bound on the number of sections, so that corrupted headers are not trusted
+constexpr size_t max_sections = 64;
+
+constexpr uint64_t prime1 = 0x9E3779B185EBCA87;
+constexpr uint64_t prime2 = 0xC2B2AE3D27D4EB4F;
+constexpr uint64_t prime3 = 0x165667B19E3779F9;
+constexpr uint64_t prime4 = 0x85EBCA77C2B2AE63;
+constexpr uint64_t prime5 = 0x27D4EB2F165667C5;
+
+inline uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t read64(const uint8_t *p) {
+    uint64_t result;
+    memcpy(&result, p, 8);
+    return result;
+}
+
+inline uint64_t read32(const uint8_t *p) {
+    uint32_t result;
+    memcpy(&result, p, 4);
+    return result;
+}
+
+inline uint64_t round(uint64_t acc, uint64_t input) {
+    return rotl(acc + input*prime2, 31)*prime1;
+}
+
+inline uint64_t merge_round(uint64_t acc, uint64_t value) {
+    return (acc ^ round(0, value))*prime1 + prime4;
+}
+
+/*
+XXH64 with seed 0. Four independent lanes consume 32 bytes per iteration, so that it runs
+at several GB/s per thread; the checksums of the chunks are computed in parallel.
+*/
+uint64_t checksum(const uint8_t *data, size_t size) {
+    const uint8_t *p = data, *end = data + size;
+    uint64_t h;
+    if (size >= 32) {
+        uint64_t v1 = prime1 + prime2, v2 = prime2, v3 = 0, v4 = 0 - prime1;
+        for (; p + 32 <= end; p += 32) {
+            v1 = round(v1, read64(p));
+            v2 = round(v2, read64(p + 8));
+            v3 = round(v3, read64(p + 16));
+            v4 = round(v4, read64(p + 24));
+        }
+        h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        h = merge_round(h, v1);
+        h = merge_round(h, v2);
+        h = merge_round(h, v3);
+        h = merge_round(h, v4);
+    } else {
+        h = prime5;
+    }
+    h += size;
+    for (; p + 8 <= end; p += 8) {
+        h = rotl(h ^ round(0, read64(p)), 27)*prime1 + prime4;
+    }
+    if (p + 4 <= end) {
+        h = rotl(h ^ read32(p)*prime1, 23)*prime2 + prime3;
+        p += 4;
+    }
+    for (; p < end; ++p) {
+        h = rotl(h ^ *p*prime5, 11)*prime1;
+    }
+    h ^= h >> 33;
+    h *= prime2;
+    h ^= h >> 29;
+    h *= prime3;
+    h ^= h >> 32;
+    return h;
+}
+
+size_t chunk_count(uint64_t size) {
+    return static_cast<size_t>((size + ContainerWriter::chunk_size - 1) / ContainerWriter::chunk_size);
+}
+
+// checksums of the chunks of [data, data + size)
+vector<uint64_t> chunk_checksums(const uint8_t *data, uint64_t size, ThreadPool &pool) {
+    size_t chunk_size = ContainerWriter::chunk_size;
+    vector<uint64_t> result(chunk_count(size));
+    pool.parallel_for(result.size(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            result[i] = checksum(data + i*chunk_size, min<uint64_t>(chunk_size, size - i*chunk_size));
+        }
+    });
+    return result;
+}
+
+// checksums of the chunks of the size bytes of f at offset; reads as many chunks at a time as there are threads
+vector<uint64_t> chunk_checksums(FILE* f, int64_t offset, uint64_t size, ThreadPool &pool) {
+    size_t chunk_size = ContainerWriter::chunk_size;
+    vector<uint64_t> result;
+    vector<uint8_t> buffer(min<uint64_t>(size, pool.size()*chunk_size));
+    seek(f, offset, SEEK_SET);
+    for (uint64_t done = 0; done < size; ) {
+        size_t n = static_cast<size_t>(min<uint64_t>(buffer.size(), size - done));
+        if (fread(buffer.data(), 1, n, f) != n) {
+            throw runtime_error("file is too short");
+        }
+        vector<uint64_t> checksums = chunk_checksums(buffer.data(), n, pool);
+        result.insert(result.end(), checksums.begin(), checksums.end());
+        done += n;
+    }
+    return result;
+}
+
+uint64_t tag_word(const string &tag) {
+    if (tag.size() > 8) {
+        throw invalid_argument("section tags have at most 8 characters");
+    }
+    uint64_t result = 0;
+    memcpy(&result, tag.data(), tag.size());
+    return result;
+}
+
+void write_zeros(FILE* f, size_t count) {
+    static const uint8_t zeros[ContainerWriter::section_alignment] = {};
+    while (count) {
+        size_t n = min(count, sizeof(zeros));
+        fwrite(zeros, 1, n, f);
+        count -= n;
+    }
+}
+
+// pads f with zeros to a multiple of alignment bytes after start
+void pad(FILE* f, int64_t start, size_t alignment) {
+    size_t position = static_cast<size_t>(tell(f) - start);
+    write_zeros(f, (alignment - position % alignment) % alignment);
+}
+
+} // namespace
+
+const char *artifact_name(Artifact kind) {
+    switch (kind) {
+    case Artifact::pp: return "pp";
+    case Artifact::ct1: return "ct1";
+    case Artifact::ct2: return "ct2";
+    case Artifact::st1: return "st1";
+    case Artifact::st2: return "st2";
+    case Artifact::sk: return "sk";
+    case Artifact::digest: return "digest";
+    }
+    return "unknown";
+}
+
+ParamsHash params_hash(const BatchSelectParams &params, const SEALContext::ContextData &context_data) {
+    const parms_id_type &parms_id = context_data.parms_id();
+    vector<uint64_t> words(parms_id.begin(), parms_id.end());
+    words.insert(words.end(), {
+        params.poly_modulus_degree, params.w, params.m, params.log_g, params.mod_plaintext, params.mod_noise });
+    // only added for balanced digits, so that the hash of unsigned instances stays the same
+    if (params.balanced) {
+        words.push_back(1);
+    }
+    ParamsHash result;
+    HashFunction::hash(words.data(), words.size(), result);
+    return result;
+}
+
+ContainerWriter::ContainerWriter(FILE* f, Artifact kind, const ParamsHash &hash, size_t section_count)
+    : f_(f), start_(tell(f)), section_count_(section_count) {
+    header_ = { container_magic, version_major << 32 | version_minor, static_cast<uint64_t>(kind) };
+    header_.insert(header_.end(), hash.begin(), hash.end());
+    header_.insert(header_.end(), { chunk_size, section_count, 0 });
+    // the header and the section table are written by finish
+    write_zeros(f_, (header_words + section_count*section_words)*8);
+}
+
+FILE* ContainerWriter::begin_section(const string &tag) {
+    if (sections_.size() == section_count_) {
+        throw logic_error("too many sections");
+    }
+    pad(f_, start_, section_alignment);
+    sections_.push_back({ tag_word(tag), static_cast<uint64_t>(tell(f_) - start_), 0, 0 });
+    return f_;
+}
+
+void ContainerWriter::end_section(ThreadPool &pool) {
+    ContainerSection &section = sections_.back();
+    fflush(f_);
+    section.size = static_cast<uint64_t>(tell(f_) - start_) - section.offset;
+    vector<uint64_t> checksums = chunk_checksums(f_, start_ + static_cast<int64_t>(section.offset), section.size, pool);
+    seek(f_, 0, SEEK_END);
+    pad(f_, start_, 8);
+    section.checksums_offset = static_cast<uint64_t>(tell(f_) - start_);
+    fwrite(checksums.data(), 8, checksums.size(), f_);
+}
+
+void ContainerWriter::finish() {
+    if (sections_.size() != section_count_) {
+        throw logic_error("missing sections");
+    }
+    vector<uint64_t> words = header_;
+    for (const ContainerSection &section : sections_) {
+        words.insert(words.end(), { section.tag, section.offset, section.size, section.checksums_offset });
+    }
+    words[checksum_index] = checksum(reinterpret_cast<const uint8_t *>(words.data()), words.size()*8);
+    seek(f_, start_, SEEK_SET);
+    fwrite(words.data(), 8, words.size(), f_);
+    seek(f_, 0, SEEK_END);
+}
+
+ContainerReader::ContainerReader(FILE* f, Artifact kind, const ParamsHash &hash)
+    : name_(artifact_name(kind)), f_(f), start_(tell(f)) {
+    seek(f_, 0, SEEK_END);
+    uint64_t file_size = static_cast<uint64_t>(tell(f_) - start_);
+    seek(f_, start_, SEEK_SET);
+    vector<uint64_t> header(header_words);
+    if (fread(header.data(), 8, header_words, f_) != header_words) {
+        header.assign(header_words, 0);
+    }
+    parse(header.data(), file_size, kind, hash);
+}
+
+ContainerReader::ContainerReader(shared_ptr<MappedFile> file, Artifact kind, const ParamsHash &hash)
+    : name_(artifact_name(kind)), file_(file) {
+    vector<uint64_t> header(header_words);
+    if (file_->size() >= header_words*8) {
+        memcpy(header.data(), file_->data(), header_words*8);
+    }
+    parse(header.data(), file_->size(), kind, hash);
+}
+
+void ContainerReader::parse(const uint64_t *header, uint64_t file_size, Artifact kind, const ParamsHash &hash) {
+    const string &name = name_;
+    if (header[0] != container_magic) {
+        throw runtime_error(name + " file is not a tinylabels container (it may have been written by an older version)");
+    }
+    if (header[1] >> 32 != ContainerWriter::version_major) {
+        throw runtime_error(name + " file has the unsupported format version "
+            + to_string(header[1] >> 32) + "." + to_string(header[1] & 0xffffffff));
+    }
+    if (header[2] != static_cast<uint64_t>(kind)) {
+        throw runtime_error(name + " file contains " + artifact_name(static_cast<Artifact>(header[2])) + " instead");
+    }
+    size_t section_count = static_cast<size_t>(header[8]);
+    if (header[7] != ContainerWriter::chunk_size || section_count > max_sections
+        || file_size < (header_words + section_count*section_words)*8) {
+        throw runtime_error(name + " file is corrupted");
+    }
+
+    vector<uint64_t> words(header, header + header_words);
+    vector<uint64_t> table = read_words(header_words*8, section_count*section_words);
+    words.insert(words.end(), table.begin(), table.end());
+    uint64_t expected = words[checksum_index];
+    words[checksum_index] = 0;
+    if (checksum(reinterpret_cast<const uint8_t *>(words.data()), words.size()*8) != expected) {
+        throw runtime_error(name + " file is corrupted");
+    }
+    // checked after the checksum, so that a corrupted hash is not reported as a parameter mismatch
+    if (!equal(hash.begin(), hash.end(), header + 3)) {
+        throw runtime_error(name + " file was created with different parameters");
+    }
+
+    for (size_t i = 0; i < section_count; ++i) {
+        const uint64_t *s = table.data() + i*section_words;
+        ContainerSection section{ s[0], s[1], s[2], s[3] };
+        if (section.offset > file_size || section.size > file_size - section.offset
+            || section.checksums_offset > file_size
+            || chunk_count(section.size) > (file_size - section.checksums_offset) / 8) {
+            throw runtime_error(name + " file is truncated");
+        }
+        sections_.push_back(section);
+    }
+}
+
+vector<uint64_t> ContainerReader::read_words(uint64_t offset, size_t count) const {
+    vector<uint64_t> result(count);
+    if (file_) {
+        memcpy(result.data(), file_->data() + offset, count*8);
+    } else {
+        seek(f_, start_ + static_cast<int64_t>(offset), SEEK_SET);
+        if (fread(result.data(), 8, count, f_) != count) {
+            throw runtime_error(name_ + " file is truncated");
+        }
+    }
+    return result;
+}
+
+const ContainerSection &ContainerReader::find(const string &tag) const {
+    uint64_t word = tag_word(tag);
+    for (const ContainerSection &section : sections_) {
+        if (section.tag == word) {
+            return section;
+        }
+    }
+    throw runtime_error(name_ + " file has no section " + tag);
+}
+
+bool ContainerReader::contains(const string &tag) const {
+    uint64_t word = tag_word(tag);
+    for (const ContainerSection &section : sections_) {
+        if (section.tag == word) {
+            return true;
+        }
+    }
+    return false;
+}
+
+FILE* ContainerReader::section(const string &tag, ThreadPool &pool) {
+    verify(tag, pool);
+    seek(f_, start_ + static_cast<int64_t>(find(tag).offset), SEEK_SET);
+    return f_;
+}
+
+size_t ContainerReader::section_offset(const string &tag) const {
+    return static_cast<size_t>(find(tag).offset);
+}
+
+void ContainerReader::verify(const string &tag, ThreadPool &pool) const {
+    const ContainerSection &s = find(tag);
+    vector<uint64_t> checksums = file_
+        ? chunk_checksums(file_->data() + s.offset, s.size, pool)
+        : chunk_checksums(f_, start_ + static_cast<int64_t>(s.offset), s.size, pool);
+    if (read_words(s.checksums_offset, checksums.size()) != checksums) {
+        throw runtime_error("section " + tag + " of " + name_ + " file is corrupted");
+    }
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "mappedfile.h"
+#include "params.h"
+#include "threadpool.h"
+#include "seal/seal.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+The files written by the tools (pp.bin, ct1.bin, ct2.bin, st1.bin, st2.bin, sk.bin, and the
+digest cache) are containers, which can be validated before any computation starts.
+
+All integers are little-endian 64-bit words. A container consists of
+- a header: the magic word "TLCONT01", the format version (major << 32 | minor), the kind
+  of the file, the hash of the parameters (see params_hash), the chunk size, the number of
+  sections, and a checksum of the header and the section table;
+- the section table, with four words per section: its tag (up to 8 characters), offset,
+  size in bytes, and the offset of its checksums;
+- the sections, each starting at a multiple of section_alignment, and each followed by the
+  checksums of its chunks of chunk_size bytes.
+
+The checksums detect corrupted or truncated files; they are not cryptographic.
+*/
+enum class Artifact : std::uint64_t {
+    pp = 1,
+    ct1 = 2,
+    ct2 = 3,
+    st1 = 4,
+    st2 = 5,
+    sk = 6,
+    digest = 7
+};
+
+const char *artifact_name(Artifact kind);
+
+using ParamsHash = std::array<std::uint64_t, 4>;
+
+// Hash of the SEAL parameters (their parms_id) together with the BatchSelect parameters.
+ParamsHash params_hash(const BatchSelectParams &params, const seal::SEALContext::ContextData &context_data);
+
+struct ContainerSection {
+    std::uint64_t tag;
+    std::uint64_t offset;
+    std::uint64_t size;
+    std::uint64_t checksums_offset;
+};
+
+class ContainerWriter {
+public:
+
+    static constexpr std::uint64_t version_major = 1;
+    static constexpr std::uint64_t version_minor = 0;
+    static constexpr std::size_t chunk_size = std::size_t(1) << 20;
+    static constexpr std::size_t section_alignment = 4096;
+
+    /**
+    Starts a container with section_count sections at the current position of f. As the
+    checksums are computed from the written data, f needs to be open for reading and writing.
+    */
+    ContainerWriter(FILE* f, Artifact kind, const ParamsHash &hash, std::size_t section_count);
+
+    // Starts the next section; its data needs to be written to the returned file.
+    FILE* begin_section(const std::string &tag);
+    // Ends the current section, and computes its checksums on pool.
+    void end_section(ThreadPool &pool);
+    // Writes the header and the section table, after all sections have been written.
+    void finish();
+
+private:
+    FILE* f_;
+    std::int64_t start_; // file position of the container (see tell and seek in container.cpp)
+    std::size_t section_count_;
+    std::vector<std::uint64_t> header_;
+    std::vector<ContainerSection> sections_;
+};
+
+class ContainerReader {
+public:
+
+    /**
+    Reads and validates the header of a container at the current position of f, or at the
+    beginning of file. Throws std::runtime_error if the file is not a container, has an
+    unsupported version, is of another kind, was written for other parameters, or if the
+    header is corrupted.
+    */
+    ContainerReader(FILE* f, Artifact kind, const ParamsHash &hash);
+    ContainerReader(std::shared_ptr<MappedFile> file, Artifact kind, const ParamsHash &hash);
+
+    const ContainerSection &find(const std::string &tag) const;
+    bool contains(const std::string &tag) const;
+
+    /**
+    Verifies the checksums of the section with the given tag (on pool), and positions the
+    file at its start. Throws std::runtime_error if a checksum does not match.
+    */
+    FILE* section(const std::string &tag, ThreadPool &pool);
+
+    /**
+    Returns the offset of the section with the given tag in the mapped file. The checksums
+    are not verified here, as that would read the whole section; use verify if needed.
+    */
+    std::size_t section_offset(const std::string &tag) const;
+    void verify(const std::string &tag, ThreadPool &pool) const;
+
+private:
+    void parse(const std::uint64_t *header, std::uint64_t file_size, Artifact kind, const ParamsHash &hash);
+    std::vector<std::uint64_t> read_words(std::uint64_t offset, std::size_t count) const;
+
+    std::string name_;
+    FILE* f_ = nullptr;
+    std::int64_t start_ = 0;
+    std::shared_ptr<MappedFile> file_;
+    std::vector<ContainerSection> sections_;
+};
@@ -4,65 +4,72 @@ using namespace std;
 using namespace seal;
 using namespace seal::util;
 
-int main()
+int main(int argc, char **argv)
 {
-    EncryptionParameters parms(scheme_type::onoff);
-    parms.set_poly_modulus_degree(poly_modulus_degree);
-    parms.set_plain_modulus(PlainModulus::Batching(poly_modulus_degree, mod_plaintext));
+    Options options = parse_options(argc, argv);
+    const BatchSelectParams &params = options.params;
 
-    vector<Modulus> coeff_modulus = CoeffModulus::Create(poly_modulus_degree, {mod_noise});
-    coeff_modulus.insert(coeff_modulus.begin(), parms.plain_modulus());
-    parms.set_coeff_modulus(coeff_modulus);
+    EncryptionParameters parms = params.encryption_parameters();
+    const vector<Modulus> &coeff_modulus = parms.coeff_modulus();
 
     SEALContext context(parms);
     auto &context_data = *context.get_context_data(parms.parms_id());
 
     cout << "Plaintext modulus: " << coeff_modulus[0].value() << "\n";
+    cout << "Parameters: " << params << "\n";
+    cout << "Threads: " << options.threads << "\n";
+    cout << "Kernels: " << select_kernels(context_data).name << "\n";
     cout << "===================\n";
 
     auto prng = UniformRandomGeneratorFactory::DefaultFactory()->create();
 
-    BatchSelect bs(context_data, prng);
+    BatchSelect bs(params, context_data, prng, options.threads);
+    bs.digest_cache = options.digest_cache;
 
-    FILE *f_pp = fopen("pp.bin", "rb");
-    bs.read_pp(f_pp);
-    fclose(f_pp);
-
-    FILE *f_ct1 = fopen("ct1.bin", "rb");
-    bs.read_ct1(f_ct1);
-    fclose(f_ct1);
+    // pp.bin and ct1.bin are used in place, without reading them
+    bs.map_pp("pp.bin");
+    bs.map_ct1("ct1.bin");
 
     FILE *f_ct2 = fopen("ct2.bin", "rb");
     bs.read_ct2(f_ct2);
     fclose(f_ct2);
 
-    FILE *f_sk = fopen("sk.bin", "rb");
-    bs.read_sk(f_sk);
-    fclose(f_sk);
-
-    Pointer<uint64_t> y(allocate_zero_uint(w*poly_modulus_degree, MemoryManager::GetPool()));
-    ifstream f_y;
-    f_y.open("y.txt");
-    for (size_t i = 0; i < w*poly_modulus_degree; ++i) {
-        f_y >> y[i];
+    vector<Pointer<uint64_t>> ys(options.queries), sks(options.queries), outs(options.queries);
+    for (size_t q = 0; q < options.queries; ++q) {
+        FILE *f_sk = fopen((query_name("sk", options, q) + ".bin").c_str(), "rb");
+        bs.read_sk(f_sk);
+        fclose(f_sk);
+        sks[q] = bs.sk();
+
+        ys[q] = allocate_zero_uint(params.label_count(), MemoryManager::GetPool());
+        read_labels(label_path(query_name("y", options, q), options.binary_labels), options.binary_labels, ys[q].get(), params.label_count(), 1, *bs.pool);
+        if (!options.dec_slice) {
+            outs[q] = allocate_zero_uint(params.label_count(), MemoryManager::GetPool());
+        }
     }
-    f_y.close();
 
     auto begin = chrono::steady_clock::now();
 
-    Pointer<uint64_t> out(allocate_zero_uint(w*poly_modulus_degree, MemoryManager::GetPool()));
-    bs.dec(y, out);
+    if (options.dec_slice) {
+        // every slice is appended to the output as soon as it is decrypted (within the measured time)
+        LabelWriter writer(label_path("output", options.binary_labels), options.binary_labels, params.label_count(), coeff_modulus[0].bit_count());
+        bs.dec(ys[0], options.dec_slice, [&](size_t, size_t count, const uint64_t *labels) {
+            writer.append(labels, count*params.poly_modulus_degree, *bs.pool);
+        });
+        writer.finish();
+    } else if (options.queries == 1) {
+        bs.dec(ys[0], outs[0]);
+    } else {
+        bs.dec_many(ys, sks, outs);
+    }
 
     cout << "===================\n";
     cout << "Total time: " << time_str(chrono::steady_clock::now() - begin) << ".\n";
     print_statistics();
 
-    ofstream f_out;
-    f_out.open("output.txt");
-    for (size_t i = 0; i < w*poly_modulus_degree; ++i) {
-        f_out << out[i] << "\n";
+    for (size_t q = 0; q < options.queries && !options.dec_slice; ++q) {
+        write_labels(label_path(query_name("output", options, q), options.binary_labels), options.binary_labels, outs[q].get(), params.label_count(), coeff_modulus[0].bit_count(), *bs.pool);
     }
-    f_out.close();
 
     return 0;
 }
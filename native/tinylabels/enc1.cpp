@@ -4,52 +4,56 @@ using namespace std;
 using namespace seal;
 using namespace seal::util;
 
-int main()
+int main(int argc, char **argv)
 {
-    EncryptionParameters parms(scheme_type::onoff);
-    parms.set_poly_modulus_degree(poly_modulus_degree);
-    parms.set_plain_modulus(PlainModulus::Batching(poly_modulus_degree, mod_plaintext));
+    Options options = parse_options(argc, argv);
+    const BatchSelectParams &params = options.params;
 
-    vector<Modulus> coeff_modulus = CoeffModulus::Create(poly_modulus_degree, {mod_noise});
-    coeff_modulus.insert(coeff_modulus.begin(), parms.plain_modulus());
-    parms.set_coeff_modulus(coeff_modulus);
+    EncryptionParameters parms = params.encryption_parameters();
+    const vector<Modulus> &coeff_modulus = parms.coeff_modulus();
 
     SEALContext context(parms);
     auto &context_data = *context.get_context_data(parms.parms_id());
 
     cout << "Plaintext modulus: " << coeff_modulus[0].value() << "\n";
+    cout << "Parameters: " << params << "\n";
+    cout << "Threads: " << options.threads << "\n";
+    cout << "Kernels: " << select_kernels(context_data).name << "\n";
     cout << "===================\n";
 
     auto prng = UniformRandomGeneratorFactory::DefaultFactory()->create();
 
-    BatchSelect bs(context_data, prng);
+    BatchSelect bs(params, context_data, prng, options.threads);
+    bs.ct_layout = options.leaf_major ? CtLayout::leaf_major : CtLayout::level_major;
 
     FILE *f_pp = fopen("pp.bin", "rb");
     bs.read_pp(f_pp);
     fclose(f_pp);
 
-    Pointer<uint64_t> l1(allocate_zero_uint(w*poly_modulus_degree, MemoryManager::GetPool()));
-    ifstream f_l1;
-    f_l1.open("l1.txt");
-    for (size_t i = 0; i < w*poly_modulus_degree; ++i) {
-        f_l1 >> l1[i];
-    }
-    f_l1.close();
+    Pointer<uint64_t> l1(allocate_zero_uint(params.label_count(), MemoryManager::GetPool()));
+    read_labels(label_path("l1", options.binary_labels), options.binary_labels, l1.get(), params.label_count(), coeff_modulus[0].bit_count(), *bs.pool);
 
     auto begin = chrono::steady_clock::now();
 
-    bs.enc1(l1);
+    // with a stream window, ct1.bin is written during the encryption (and included in the time)
+    FILE *f_ct1 = fopen("ct1.bin", "w+b");
+    if (options.stream_window) {
+        bs.enc1(l1, f_ct1, options.packed, options.stream_window);
+    } else {
+        bs.enc1(l1);
+    }
 
     cout << "===================\n";
     cout << "Total time: " << time_str(chrono::steady_clock::now() - begin) << ".\n";
     print_statistics();
 
-    FILE *f_st1 = fopen("st1.bin", "wb");
-    bs.save_st1(f_st1);
+    FILE *f_st1 = fopen("st1.bin", "w+b");
+    bs.save_st1(f_st1, options.packed);
     fclose(f_st1);
 
-    FILE *f_ct1 = fopen("ct1.bin", "wb");
-    bs.save_ct1(f_ct1);
+    if (!options.stream_window) {
+        bs.save_ct1(f_ct1, options.packed);
+    }
     fclose(f_ct1);
 
     return 0;
@@ -4,15 +4,13 @@ using namespace std;
 using namespace seal;
 using namespace seal::util;
 
-int main()
+int main(int argc, char **argv)
 {
-    EncryptionParameters parms(scheme_type::onoff);
-    parms.set_poly_modulus_degree(poly_modulus_degree);
-    parms.set_plain_modulus(PlainModulus::Batching(poly_modulus_degree, mod_plaintext));
+    Options options = parse_options(argc, argv);
+    const BatchSelectParams &params = options.params;
 
-    vector<Modulus> coeff_modulus = CoeffModulus::Create(poly_modulus_degree, {mod_noise});
-    coeff_modulus.insert(coeff_modulus.begin(), parms.plain_modulus());
-    parms.set_coeff_modulus(coeff_modulus);
+    EncryptionParameters parms = params.encryption_parameters();
+    const vector<Modulus> &coeff_modulus = parms.coeff_modulus();
 
     SEALContext context(parms);
     auto &context_data = *context.get_context_data(parms.parms_id());
@@ -20,21 +18,19 @@ int main()
     auto prng = UniformRandomGeneratorFactory::DefaultFactory()->create();
 
     cout << "Plaintext modulus: " << coeff_modulus[0].value() << "\n";
+    cout << "Parameters: " << params << "\n";
+    cout << "Threads: " << options.threads << "\n";
+    cout << "Kernels: " << select_kernels(context_data).name << "\n";
     cout << "===================\n";
 
-    BatchSelect bs(context_data, prng);
+    BatchSelect bs(params, context_data, prng, options.threads);
 
     FILE *f_pp = fopen("pp.bin", "rb");
     bs.read_pp(f_pp);
     fclose(f_pp);
 
-    Pointer<uint64_t> l2(allocate_zero_uint(w*poly_modulus_degree, MemoryManager::GetPool()));
-    ifstream f_l2;
-    f_l2.open("l2.txt");
-    for (size_t i = 0; i < w*poly_modulus_degree; ++i) {
-        f_l2 >> l2[i];
-    }
-    f_l2.close();
+    Pointer<uint64_t> l2(allocate_zero_uint(params.label_count(), MemoryManager::GetPool()));
+    read_labels(label_path("l2", options.binary_labels), options.binary_labels, l2.get(), params.label_count(), coeff_modulus[0].bit_count(), *bs.pool);
 
     auto begin = chrono::steady_clock::now();
 
@@ -44,12 +40,12 @@ int main()
     cout << "Total time: " << time_str(chrono::steady_clock::now() - begin) << ".\n";
     print_statistics();
 
-    FILE *f_st2 = fopen("st2.bin", "wb");
-    bs.save_st2(f_st2);
+    FILE *f_st2 = fopen("st2.bin", "w+b");
+    bs.save_st2(f_st2, options.packed);
     fclose(f_st2);
 
-    FILE *f_ct2 = fopen("ct2.bin", "wb");
-    bs.save_ct2(f_ct2);
+    FILE *f_ct2 = fopen("ct2.bin", "w+b");
+    bs.save_ct2(f_ct2, options.packed);
     fclose(f_ct2);
 
     return 0;
@@ -4,15 +4,13 @@ using namespace std;
 using namespace seal;
 using namespace seal::util;
 
-int main()
+int main(int argc, char **argv)
 {
-    EncryptionParameters parms(scheme_type::onoff);
-    parms.set_poly_modulus_degree(poly_modulus_degree);
-    parms.set_plain_modulus(PlainModulus::Batching(poly_modulus_degree, mod_plaintext));
+    Options options = parse_options(argc, argv);
+    const BatchSelectParams &params = options.params;
 
-    vector<Modulus> coeff_modulus = CoeffModulus::Create(poly_modulus_degree, {mod_noise});
-    coeff_modulus.insert(coeff_modulus.begin(), parms.plain_modulus());
-    parms.set_coeff_modulus(coeff_modulus);
+    EncryptionParameters parms = params.encryption_parameters();
+    const vector<Modulus> &coeff_modulus = parms.coeff_modulus();
 
     SEALContext context(parms);
     auto &context_data = *context.get_context_data(parms.parms_id());
@@ -21,52 +19,37 @@ int main()
     cout << "===================\n";
     cout << "Generating l1, l2, y, and expected (l1*y+l2)...\n";
 
-    Pointer<uint64_t> l1(allocate_zero_uint(w*poly_modulus_degree, MemoryManager::GetPool()));
-    Pointer<uint64_t> l2(allocate_zero_uint(w*poly_modulus_degree, MemoryManager::GetPool()));
-    Pointer<uint64_t> out(allocate_zero_uint(w*poly_modulus_degree, MemoryManager::GetPool()));
-    Pointer<uint64_t> y(allocate_zero_uint(w*poly_modulus_degree, MemoryManager::GetPool()));
+    Pointer<uint64_t> l1(allocate_zero_uint(params.label_count(), MemoryManager::GetPool()));
+    Pointer<uint64_t> l2(allocate_zero_uint(params.label_count(), MemoryManager::GetPool()));
+    Pointer<uint64_t> out(allocate_zero_uint(params.label_count(), MemoryManager::GetPool()));
+    Pointer<uint64_t> y(allocate_zero_uint(params.label_count(), MemoryManager::GetPool()));
 
     std::random_device rd;
     std::mt19937_64 e2(rd());
     std::uniform_int_distribution<uint64_t> dist(0, coeff_modulus[0].value()-1);
     std::uniform_int_distribution<uint64_t> bin(0, 1);
 
-    for (size_t i = 0; i < w*poly_modulus_degree; ++i) {
+    for (size_t i = 0; i < params.label_count(); ++i) {
         l1[i] = dist(e2);
         l2[i] = dist(e2);
-        y[i] = bin(e2);
-        out[i] = (l1[i]*y[i] + l2[i]) % coeff_modulus[0].value();
     }
 
-    cout << "Done.\n";
-
-    ofstream f_l1;
-    f_l1.open("l1.txt");
-    for (size_t i = 0; i < w*poly_modulus_degree; ++i) {
-        f_l1 << l1[i] << "\n";
-    }
-    f_l1.close();
+    ThreadPool pool(options.threads);
 
-    ofstream f_l2;
-    f_l2.open("l2.txt");
-    for (size_t i = 0; i < w*poly_modulus_degree; ++i) {
-        f_l2 << l2[i] << "\n";
-    }
-    f_l2.close();
+    write_labels(label_path("l1", options.binary_labels), options.binary_labels, l1.get(), params.label_count(), coeff_modulus[0].bit_count(), pool);
+    write_labels(label_path("l2", options.binary_labels), options.binary_labels, l2.get(), params.label_count(), coeff_modulus[0].bit_count(), pool);
 
-    ofstream f_y;
-    f_y.open("y.txt");
-    for (size_t i = 0; i < w*poly_modulus_degree; ++i) {
-        f_y << y[i] << "\n";
+    // one choice vector (and expected output) per query
+    for (size_t q = 0; q < options.queries; ++q) {
+        for (size_t i = 0; i < params.label_count(); ++i) {
+            y[i] = bin(e2);
+            out[i] = (l1[i]*y[i] + l2[i]) % coeff_modulus[0].value();
+        }
+        write_labels(label_path(query_name("y", options, q), options.binary_labels), options.binary_labels, y.get(), params.label_count(), 1, pool);
+        write_labels(label_path(query_name("expected", options, q), options.binary_labels), options.binary_labels, out.get(), params.label_count(), coeff_modulus[0].bit_count(), pool);
     }
-    f_y.close();
 
-    ofstream f_expected;
-    f_expected.open("expected.txt");
-    for (size_t i = 0; i < w*poly_modulus_degree; ++i) {
-        f_expected << out[i] << "\n";
-    }
-    f_expected.close();
+    cout << "Done.\n";
 
     return 0;
 }
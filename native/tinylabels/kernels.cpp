@@ -0,0 +1,449 @@
+#include "kernels.h"
+#include "seal/util/ntt.h"
+#include "seal/util/polyarithsmallmod.h"
+#include "seal/util/rns.h"
+#include "seal/util/uintarith.h"
+#include "seal/util/uintarithsmallmod.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+using namespace std;
+using namespace seal;
+using namespace seal::util;
+
+PreparedPolys::PreparedPolys(PolyIter values, size_t count, const vector<Modulus> &coeff_modulus) :
+    values_(values), count_(count) {
+    size_t poly_modulus_degree = values.poly_modulus_degree();
+    data_quotients_ = allocate_poly_array(count, poly_modulus_degree, coeff_modulus.size(), MemoryManager::GetPool());
+    SEAL_ITERATE(iter(values, quotients()), count, [&](const tuple<RNSIter,RNSIter> &I) {
+        SEAL_ITERATE(iter(get<0>(I), get<1>(I), coeff_modulus), coeff_modulus.size(), [&](auto J) {
+            SEAL_ITERATE(iter(get<0>(J), get<1>(J)), poly_modulus_degree, [&](auto K) {
+                MultiplyUIntModOperand operand;
+                operand.set(get<0>(K), get<2>(J));
+                get<1>(K) = operand.quotient;
+            });
+        });
+    });
+}
+
+PolyIter PreparedPolys::quotients() const {
+    return PolyIter(data_quotients_.get(), values_.poly_modulus_degree(), values_.coeff_modulus_size());
+}
+
+namespace {
+
+/*
+Splits x = (low, high) in [0, q) into m balanced digits in [-g/2, g/2] with x = sum digits[i]*g^i
+mod q. x is centered into (-q/2, q/2] first (as a two's complement 128-bit value; half_q is
+(q-1)/2), and every digit is taken from the low bits and moved into [-g/2, g/2) by carrying g
+into the next one; the last digit is what remains, which is within [-g/2, g/2] as g^m > q.
+*/
+inline void balanced_digits(uint64_t low, uint64_t high, const uint64_t *q, const uint64_t *half_q, size_t m, size_t log_g, int64_t *digits) {
+    if (high > half_q[1] || (high == half_q[1] && low > half_q[0])) {
+        uint64_t borrow = low < q[0];
+        low -= q[0];
+        high -= q[1] + borrow;
+    }
+    uint64_t mask = (uint64_t(1) << log_g) - 1, half_g = uint64_t(1) << (log_g - 1);
+    for (size_t i = 0; i + 1 < m; ++i) {
+        uint64_t digit = low & mask, carry = digit >= half_g;
+        digits[i] = static_cast<int64_t>(digit) - static_cast<int64_t>(carry << log_g);
+        low = (low >> log_g) | (high << (64 - log_g));
+        high = static_cast<uint64_t>(static_cast<int64_t>(high) >> log_g);
+        low += carry;
+        high += low < carry;
+    }
+    digits[m - 1] = static_cast<int64_t>(low);
+}
+
+// residue of a signed value modulo modulus
+inline uint64_t signed_residue(int64_t value, const Modulus &modulus) {
+    uint64_t magnitude = barrett_reduce_64(value < 0 ? 0 - static_cast<uint64_t>(value) : static_cast<uint64_t>(value), modulus);
+    return value < 0 && magnitude ? modulus.value() - magnitude : magnitude;
+}
+
+// q = q0*q1 and (q-1)/2 as 128-bit values, for balanced_digits
+inline void modulus_product(const vector<Modulus> &coeff_modulus, uint64_t *q, uint64_t *half_q) {
+    unsigned long long product[2];
+    multiply_uint64(coeff_modulus[0].value(), coeff_modulus[1].value(), product);
+    q[0] = product[0];
+    q[1] = product[1];
+    half_q[0] = (q[0] >> 1) | (q[1] << 63);
+    half_q[1] = q[1] >> 1;
+}
+
+void generic_outer_product(PolyIter a, size_t len_a, const PreparedPolys &b, PolyIter destination, const vector<Modulus> &coeff_modulus) {
+    size_t len_b = b.count();
+    counter_poly_mult += len_a*len_b*coeff_modulus.size();
+    auto begin = chrono::steady_clock::now();
+
+    size_t poly_modulus_degree = a.poly_modulus_degree();
+    SEAL_ITERATE(iter(a, seq_iter(0)), len_a, [&](const tuple<RNSIter,uint64_t> &I) {
+        SEAL_ITERATE(iter(b.values(), b.quotients(), destination + get<1>(I)*len_b), len_b, [&](const tuple<RNSIter,RNSIter,RNSIter> &J) {
+            SEAL_ITERATE(iter(get<0>(I), get<0>(J), get<1>(J), get<2>(J), coeff_modulus), coeff_modulus.size(), [&](auto K) {
+                SEAL_ITERATE(iter(get<0>(K), get<1>(K), get<2>(K), get<3>(K)), poly_modulus_degree, [&](auto L) {
+                    get<3>(L) = multiply_uint_mod(get<0>(L), MultiplyUIntModOperand{ get<1>(L), get<2>(L) }, get<4>(K));
+                });
+            });
+        });
+    });
+    time_poly_mult += (chrono::steady_clock::now() - begin).count();
+}
+
+// Products are accumulated without intermediate reductions (see dyadic_product_accumulate).
+void generic_inner_product(PolyIter a, PolyIter b, size_t len, RNSIter destination, const vector<Modulus> &coeff_modulus) {
+    dyadic_product_accumulate(a, b, len, coeff_modulus, destination);
+}
+
+void generic_multiply_g(RNSIter a, PolyIter destination, const BatchSelectParams &params, const SEALContext::ContextData &context_data) {
+    const EncryptionParameters &parms = context_data.parms();
+    size_t poly_modulus_degree = parms.poly_modulus_degree();
+    const vector<Modulus> &coeff_modulus = parms.coeff_modulus();
+    size_t coeff_modulus_size = coeff_modulus.size();
+    size_t m = params.m;
+    uint64_t g = params.g();
+
+    set_poly(a, poly_modulus_degree, coeff_modulus_size, destination);
+    for (size_t i = 1; i < m; ++i) {
+        multiply_poly_scalar_coeffmod(destination[i-1], coeff_modulus_size, g, coeff_modulus, destination[i]);
+    }
+}
+
+void generic_decompose_g_one(RNSIter y, PolyIter destination, const BatchSelectParams &params, const SEALContext::ContextData &context_data) {
+    const EncryptionParameters &parms = context_data.parms();
+    size_t poly_modulus_degree = parms.poly_modulus_degree();
+    const vector<Modulus> &coeff_modulus = parms.coeff_modulus();
+    size_t coeff_modulus_size = coeff_modulus.size();
+    size_t m = params.m;
+    uint64_t g = params.g();
+    auto ntt_tables = context_data.small_ntt_tables();
+
+    Pointer<uint64_t> y_composed = allocate_poly(poly_modulus_degree, coeff_modulus_size, MemoryManager::GetPool());
+    RNSIter y_composed_iter(y_composed.get(), poly_modulus_degree);
+
+    set_poly(*y, poly_modulus_degree, coeff_modulus_size, y_composed.get());
+    inverse_ntt_negacyclic_harvey(y_composed_iter, coeff_modulus_size, ntt_tables); // inverse NTT
+    context_data.rns_tool()->base_q()->compose_array(y_composed.get(), poly_modulus_degree, MemoryManager::GetPool()); // combine the two mod values into a single integers
+
+    if (params.balanced) {
+        uint64_t q[2], half_q[2];
+        modulus_product(coeff_modulus, q, half_q);
+        vector<int64_t> digits(m);
+        for (size_t k = 0; k < poly_modulus_degree; ++k) {
+            balanced_digits(y_composed[2*k], y_composed[2*k+1], q, half_q, m, params.log_g, digits.data());
+            for (size_t i = 0; i < m; ++i) {
+                for (size_t r = 0; r < coeff_modulus_size; ++r) {
+                    destination[i][r][k] = signed_residue(digits[i], coeff_modulus[r]);
+                }
+            }
+        }
+        ntt_negacyclic_harvey(destination, m, ntt_tables);
+        return;
+    }
+
+    SEAL_ITERATE(destination, m, [&](const RNSIter &I) {
+        // take mod g, and divide by g:
+        SEAL_ITERATE(iter(StrideIter<uint64_t*>(y_composed, coeff_modulus_size), StrideIter<uint64_t*>((*I).ptr(), coeff_modulus_size)), poly_modulus_degree, [&](const tuple<uint64_t*,uint64_t*> &J) {
+            SEAL_DIVIDE_UINT128_UINT64(get<0>(J), g, get<1>(J));
+            swap(*(get<0>(J)), *(get<1>(J)));
+            swap(*(get<0>(J)+1), *(get<1>(J)+1));
+        });
+        context_data.rns_tool()->base_q()->decompose_array((*I).ptr(), poly_modulus_degree, MemoryManager::GetPool()); // back into mod form
+        ntt_negacyclic_harvey(I, coeff_modulus_size, ntt_tables); // forward NTT
+    });
+}
+
+void generic_decompose_g(PolyIter y, size_t count, PolyIter destination, const BatchSelectParams &params, const SEALContext::ContextData &context_data) {
+    for (size_t c = 0; c < count; ++c) {
+        generic_decompose_g_one(y[c], destination + c*params.m, params, context_data);
+    }
+}
+
+void generic_decode(RNSIter res, uint64_t *out, const SEALContext::ContextData &context_data) {
+    const EncryptionParameters &parms = context_data.parms();
+    size_t poly_modulus_degree = parms.poly_modulus_degree();
+    const vector<Modulus> &coeff_modulus = parms.coeff_modulus();
+
+    MultiplyUIntModOperand inv = *context_data.rns_tool()->base_q()->inv_punctured_prod_mod_base_array();
+
+    // Step 1: subtract the error from res[0] (it is given in res[1], but as a different modulus)
+    inverse_ntt_negacyclic_harvey(res[1], context_data.small_ntt_tables()[1]);
+    // Step 1b: Now we need to convert to a different modulus (this is relevant whenever some coefficient is negative!)
+    uint64_t modulus_value = coeff_modulus[1].value();
+    uint64_t modulus_value_plaintext = coeff_modulus[0].value();
+    SEAL_ITERATE(res[1], poly_modulus_degree, [&](uint64_t &val) {
+        if (val > modulus_value/2) val = modulus_value_plaintext - (modulus_value - val);
+    });
+    ntt_negacyclic_harvey(res[1], context_data.small_ntt_tables()[0]);
+    sub_poly_coeffmod(res[0], res[1], poly_modulus_degree, coeff_modulus[0], res[0]);
+    // Step 2: remove the factor of Delta from res[0] by multiplying with its inverse
+    multiply_poly_scalar_coeffmod(res[0], poly_modulus_degree, inv, coeff_modulus[0], res[0]);
+    // Step 3: copy output
+    set_uint(res, poly_modulus_degree, out);
+}
+
+} // namespace
+
+const KernelTable &GenericKernels::table() {
+    static const KernelTable table{
+        "generic", generic_outer_product, generic_inner_product, generic_multiply_g, generic_decompose_g, generic_decode };
+    return table;
+}
+
+namespace {
+
+// Returns x*y mod modulus_value, where y_quotient is the Shoup quotient of y (see PreparedPolys).
+inline uint64_t multiply_shoup(uint64_t x, uint64_t y, uint64_t y_quotient, uint64_t modulus_value) {
+    unsigned long long high;
+    multiply_uint64_hw64(x, y_quotient, &high);
+    uint64_t result = x*y - high*modulus_value;
+    return SEAL_COND_SELECT(result >= modulus_value, result - modulus_value, result);
+}
+
+/*
+The kernels below work on raw pointers: polynomial i starts at i*N*RNS, and its residues
+modulo coeff_modulus[r] at i*N*RNS + r*N. Each modulus is copied into a local variable
+before use, so that the compiler can keep its constants in registers (stores through
+the uint64_t pointers could alias a Modulus in memory otherwise).
+*/
+template <size_t N, size_t RNS>
+struct Impl {
+    static constexpr size_t poly_size = N*RNS;
+
+    // the ciphertext modulus consists of the plaintext modulus and one additional prime
+    static_assert(RNS == 2, "decompose_g and decode expect exactly two moduli");
+    static_assert(N && !(N & (N-1)), "N needs to be a power of 2");
+
+    static void outer_product(PolyIter a, size_t len_a, const PreparedPolys &b, PolyIter destination, const vector<Modulus> &coeff_modulus) {
+        size_t len_b = b.count();
+        counter_poly_mult += len_a*len_b*RNS;
+        auto begin = chrono::steady_clock::now();
+
+        const uint64_t *a_ptr = a;
+        const uint64_t *b_ptr = b.values();
+        const uint64_t *b_quotient_ptr = b.quotients();
+        uint64_t *dest_ptr = destination;
+        for (size_t r = 0; r < RNS; ++r) {
+            const uint64_t modulus_value = coeff_modulus[r].value();
+            for (size_t i = 0; i < len_a; ++i) {
+                const uint64_t *x = a_ptr + i*poly_size + r*N;
+                for (size_t j = 0; j < len_b; ++j) {
+                    const uint64_t *y = b_ptr + j*poly_size + r*N;
+                    const uint64_t *y_quotient = b_quotient_ptr + j*poly_size + r*N;
+                    uint64_t *d = dest_ptr + (i*len_b + j)*poly_size + r*N;
+                    for (size_t k = 0; k < N; ++k) {
+                        d[k] = multiply_shoup(x[k], y[k], y_quotient[k], modulus_value);
+                    }
+                }
+            }
+        }
+        time_poly_mult += (chrono::steady_clock::now() - begin).count();
+    }
+
+    static void inner_product(PolyIter a, PolyIter b, size_t len, RNSIter destination, const vector<Modulus> &coeff_modulus) {
+        // the sum of len products needs to fit into 128 bits; this holds for any practical len
+        for (size_t r = 0; r < RNS; ++r) {
+            int free_bits = 128 - 2*coeff_modulus[r].bit_count();
+            if (free_bits < numeric_limits<size_t>::digits && len >= (size_t(1) << free_bits)) {
+                dyadic_product_accumulate(a, b, len, coeff_modulus, destination);
+                return;
+            }
+        }
+
+        counter_poly_mult += len*RNS;
+        auto begin = chrono::steady_clock::now();
+
+        // the coefficients are processed in blocks, so that the accumulators stay in the L1 cache
+        constexpr size_t block = N < 512 ? N : 512;
+        const uint64_t *a_ptr = a;
+        const uint64_t *b_ptr = b;
+        uint64_t *dest_ptr = destination;
+        for (size_t r = 0; r < RNS; ++r) {
+            const Modulus modulus = coeff_modulus[r];
+            for (size_t kb = 0; kb < N; kb += block) {
+                unsigned long long acc[block][2]{};
+                for (size_t i = 0; i < len; ++i) {
+                    const uint64_t *x = a_ptr + i*poly_size + r*N + kb;
+                    const uint64_t *y = b_ptr + i*poly_size + r*N + kb;
+                    for (size_t k = 0; k < block; ++k) {
+                        unsigned long long z[2];
+                        multiply_uint64(x[k], y[k], z);
+                        add_uint128(z, acc[k], acc[k]);
+                    }
+                }
+                uint64_t *d = dest_ptr + r*N + kb;
+                for (size_t k = 0; k < block; ++k) {
+                    d[k] = barrett_reduce_128(acc[k], modulus);
+                }
+            }
+        }
+        time_poly_mult += (chrono::steady_clock::now() - begin).count();
+    }
+
+    static void multiply_g(RNSIter a, PolyIter destination, const BatchSelectParams &params, const SEALContext::ContextData &context_data) {
+        const vector<Modulus> &coeff_modulus = context_data.parms().coeff_modulus();
+        size_t m = params.m;
+        uint64_t g = params.g();
+
+        counter_poly_mult_scalar += (m-1)*RNS;
+        auto begin = chrono::steady_clock::now();
+
+        const uint64_t *a_ptr = a;
+        uint64_t *dest_ptr = destination;
+        for (size_t r = 0; r < RNS; ++r) {
+            const Modulus modulus = coeff_modulus[r];
+            MultiplyUIntModOperand g_operand;
+            g_operand.set(barrett_reduce_64(g, modulus), modulus);
+
+            memcpy(dest_ptr + r*N, a_ptr + r*N, N*sizeof(uint64_t));
+            for (size_t i = 1; i < m; ++i) {
+                const uint64_t *x = dest_ptr + (i-1)*poly_size + r*N;
+                uint64_t *d = dest_ptr + i*poly_size + r*N;
+                for (size_t k = 0; k < N; ++k) {
+                    d[k] = multiply_uint_mod(x[k], g_operand, modulus);
+                }
+            }
+        }
+        time_poly_mult_scalar += (chrono::steady_clock::now() - begin).count();
+    }
+
+    // number of polynomials that decompose_g transforms together (bounds its scratch space)
+    static constexpr size_t decompose_batch = 16;
+
+    /*
+    The decomposition lifts every coefficient from its two residues to the integer in [0, q0*q1)
+    with Garner's formula x = x0 + q0*((x1 - x0)*q0^-1 mod q1), and splits it into m digits with
+    masks and shifts (as g is a power of 2) in the same pass; the digits are below g, so their
+    residues are the digits themselves unless g exceeds a prime (balanced digits are centered
+    first, see balanced_digits). The NTTs are done for whole batches of polynomials.
+    */
+    static void decompose_g(PolyIter y, size_t count, PolyIter destination, const BatchSelectParams &params, const SEALContext::ContextData &context_data) {
+        const vector<Modulus> &coeff_modulus = context_data.parms().coeff_modulus();
+        size_t m = params.m;
+        size_t log_g = params.log_g;
+        uint64_t mask = params.g() - 1;
+        auto ntt_tables = context_data.small_ntt_tables();
+
+        const Modulus q0 = coeff_modulus[0], q1 = coeff_modulus[1];
+        const uint64_t q0_value = q0.value(), q1_value = q1.value();
+        uint64_t q0_inv_value;
+        if (!try_invert_uint_mod(q0_value, q1, q0_inv_value)) {
+            throw logic_error("the moduli need to be coprime");
+        }
+        MultiplyUIntModOperand q0_inv;
+        q0_inv.set(q0_inv_value, q1);
+        bool reduce_x0 = q0_value > q1_value;
+        bool reduce_digits = mask >= q0_value || mask >= q1_value;
+        uint64_t q[2], half_q[2];
+        modulus_product(coeff_modulus, q, half_q);
+        vector<int64_t> digits(m);
+
+        Pointer<uint64_t> temp = allocate_poly_array(min(count, decompose_batch), N, RNS, MemoryManager::GetPool());
+        const uint64_t *y_ptr = y;
+        uint64_t *dest_ptr = destination;
+        for (size_t first = 0; first < count; first += decompose_batch) {
+            size_t batch = min(count - first, decompose_batch);
+            memcpy(temp.get(), y_ptr + first*poly_size, batch*poly_size*sizeof(uint64_t));
+            inverse_ntt_negacyclic_harvey(PolyIter(temp.get(), N, RNS), batch, ntt_tables);
+
+            counter_poly_compose += batch;
+            counter_poly_decompose += batch*m;
+            auto begin = chrono::steady_clock::now();
+            for (size_t c = 0; c < batch; ++c) {
+                const uint64_t *v = temp.get() + c*poly_size;
+                uint64_t *d = dest_ptr + (first + c)*m*poly_size;
+                for (size_t k = 0; k < N; ++k) {
+                    uint64_t x0 = v[k], x1 = v[N + k];
+                    uint64_t t = multiply_uint_mod(sub_uint_mod(x1, reduce_x0 ? barrett_reduce_64(x0, q1) : x0, q1), q0_inv, q1);
+                    unsigned long long z[2];
+                    multiply_uint64(q0_value, t, z);
+                    uint64_t low = z[0] + x0, high = z[1] + (low < x0);
+                    if (params.balanced) {
+                        balanced_digits(low, high, q, half_q, m, log_g, digits.data());
+                        for (size_t i = 0; i < m; ++i) {
+                            int64_t digit = digits[i];
+                            d[i*poly_size + k] = reduce_digits ? signed_residue(digit, q0) : digit < 0 ? q0_value + digit : digit;
+                            d[i*poly_size + N + k] = reduce_digits ? signed_residue(digit, q1) : digit < 0 ? q1_value + digit : digit;
+                        }
+                        continue;
+                    }
+                    for (size_t i = 0; i < m; ++i) {
+                        uint64_t digit = low & mask;
+                        d[i*poly_size + k] = reduce_digits ? barrett_reduce_64(digit, q0) : digit;
+                        d[i*poly_size + N + k] = reduce_digits ? barrett_reduce_64(digit, q1) : digit;
+                        low = (low >> log_g) | (high << (64 - log_g));
+                        high >>= log_g;
+                    }
+                }
+            }
+            time_poly_compose += (chrono::steady_clock::now() - begin).count();
+
+            ntt_negacyclic_harvey(PolyIter(dest_ptr + first*m*poly_size, N, RNS), batch*m, ntt_tables);
+        }
+    }
+
+    static void decode(RNSIter res, uint64_t *out, const SEALContext::ContextData &context_data) {
+        const vector<Modulus> &coeff_modulus = context_data.parms().coeff_modulus();
+        const Modulus plain_modulus = coeff_modulus[0];
+        const uint64_t modulus_value = coeff_modulus[1].value();
+        const uint64_t modulus_value_plaintext = plain_modulus.value();
+        MultiplyUIntModOperand inv = *context_data.rns_tool()->base_q()->inv_punctured_prod_mod_base_array();
+
+        uint64_t *res0 = res[0];
+        uint64_t *res1 = res[1];
+
+        // the error is given in res[1], as a centered value modulo the second prime
+        inverse_ntt_negacyclic_harvey(res[1], context_data.small_ntt_tables()[1]);
+        for (size_t k = 0; k < N; ++k) {
+            uint64_t val = res1[k];
+            res1[k] = val > modulus_value/2 ? modulus_value_plaintext - (modulus_value - val) : val;
+        }
+        ntt_negacyclic_harvey(res[1], context_data.small_ntt_tables()[0]);
+
+        // subtract the error and remove the factor of Delta in a single pass
+        counter_poly_sub++;
+        counter_poly_mult_scalar++;
+        auto begin = chrono::steady_clock::now();
+        for (size_t k = 0; k < N; ++k) {
+            out[k] = multiply_uint_mod(sub_uint_mod(res0[k], res1[k], plain_modulus), inv, plain_modulus);
+        }
+        time_poly_mult_scalar += (chrono::steady_clock::now() - begin).count();
+    }
+};
+
+} // namespace
+
+template <size_t N, size_t RNS>
+const KernelTable &BatchSelectKernels<N, RNS>::table() {
+    using K = Impl<N, RNS>;
+    static const KernelTable table{
+        "specialized for N = " + to_string(N) + " and " + to_string(RNS) + " moduli",
+        K::outer_product, K::inner_product, K::multiply_g, K::decompose_g, K::decode };
+    return table;
+}
+
+template struct BatchSelectKernels<4096, 2>;
+template struct BatchSelectKernels<8192, 2>;
+
+const KernelTable &select_kernels(const SEALContext::ContextData &context_data) {
+    const char *env = getenv("TINYLABELS_KERNELS");
+    if (env && string(env) == "generic") {
+        return GenericKernels::table();
+    }
+
+    const EncryptionParameters &parms = context_data.parms();
+    if (parms.coeff_modulus().size() == 2) {
+        switch (parms.poly_modulus_degree()) {
+        case 4096:
+            return BatchSelectKernels<4096, 2>::table();
+        case 8192:
+            return BatchSelectKernels<8192, 2>::table();
+        }
+    }
+    return GenericKernels::table();
+}
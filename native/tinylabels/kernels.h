@@ -0,0 +1,90 @@
+#pragma once
+
+#include "params.h"
+#include "seal/seal.h"
+#include "seal/util/iterator.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+Polynomials that are multiplied with many others, together with the Shoup quotients
+floor(x * 2^64 / q) of all their coefficients x (as in seal::util::MultiplyUIntModOperand).
+With the quotient, a modular product takes two multiplications and a conditional subtraction
+instead of a Barrett reduction of the 128-bit product. The quotients are laid out like the
+polynomials; the polynomials themselves are not copied, and need to outlive this.
+*/
+struct PreparedPolys {
+public:
+    PreparedPolys(seal::util::PolyIter values, std::size_t count, const std::vector<seal::Modulus> &coeff_modulus);
+
+    seal::util::PolyIter values() const { return values_; }
+    seal::util::PolyIter quotients() const;
+    std::size_t count() const { return count_; }
+
+//private:
+    seal::util::PolyIter values_;
+    std::size_t count_;
+    seal::util::Pointer<std::uint64_t> data_quotients_;
+};
+
+/**
+The polynomial kernels used by the hot loops of LHE, Lenc and BatchSelect.
+
+All polynomials are in RNS form with poly_modulus_degree coefficients per modulus. The
+generic kernels work for any parameters; the kernels of BatchSelectKernels<N, RNS> have
+the degree and the number of moduli as compile-time constants. Both compute exactly the
+same results, and they update the same operation counters.
+*/
+struct KernelTable {
+    std::string name;
+
+    // destination[i*b.count() + j] = a[i]*b[j] (i.e., the matrix in a row-wise order)
+    void (*outer_product)(
+        seal::util::PolyIter a, std::size_t len_a, const PreparedPolys &b, seal::util::PolyIter destination,
+        const std::vector<seal::Modulus> &coeff_modulus);
+
+    // destination = a[0]*b[0] + ... + a[len-1]*b[len-1]
+    void (*inner_product)(
+        seal::util::PolyIter a, seal::util::PolyIter b, std::size_t len, seal::util::RNSIter destination,
+        const std::vector<seal::Modulus> &coeff_modulus);
+
+    // destination[i] = g^i * a for i < m
+    void (*multiply_g)(
+        seal::util::RNSIter a, seal::util::PolyIter destination, const BatchSelectParams &params,
+        const seal::SEALContext::ContextData &context_data);
+
+    // destination[c*m..c*m+m-1] = the base-g digits of y[c] for c < count (y and destination are in NTT form)
+    void (*decompose_g)(
+        seal::util::PolyIter y, std::size_t count, seal::util::PolyIter destination, const BatchSelectParams &params,
+        const seal::SEALContext::ContextData &context_data);
+
+    // Decodes one block of the decryption result (which is overwritten) into poly_modulus_degree labels.
+    void (*decode)(seal::util::RNSIter res, std::uint64_t *out, const seal::SEALContext::ContextData &context_data);
+};
+
+/**
+The generic kernels, based on the SEAL polynomial arithmetic.
+*/
+struct GenericKernels {
+    static const KernelTable &table();
+};
+
+/**
+Kernels for a fixed degree N and a fixed number RNS of moduli. All loop bounds and strides
+are compile-time constants, which lets the compiler unroll and vectorize the inner loops.
+Instances exist for the degrees accepted by select_kernels.
+*/
+template <std::size_t N, std::size_t RNS>
+struct BatchSelectKernels {
+    static const KernelTable &table();
+};
+
+/**
+Returns the specialized kernels for the degree and number of moduli of context_data if
+they exist, and the generic kernels otherwise. Setting the environment variable
+TINYLABELS_KERNELS to "generic" forces the generic kernels.
+*/
+const KernelTable &select_kernels(const seal::SEALContext::ContextData &context_data);
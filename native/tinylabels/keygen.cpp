@@ -4,25 +4,27 @@ using namespace std;
 using namespace seal;
 using namespace seal::util;
 
-int main()
+int main(int argc, char **argv)
 {
-    EncryptionParameters parms(scheme_type::onoff);
-    parms.set_poly_modulus_degree(poly_modulus_degree);
-    parms.set_plain_modulus(PlainModulus::Batching(poly_modulus_degree, mod_plaintext));
+    Options options = parse_options(argc, argv);
+    const BatchSelectParams &params = options.params;
 
-    vector<Modulus> coeff_modulus = CoeffModulus::Create(poly_modulus_degree, {mod_noise});
-    coeff_modulus.insert(coeff_modulus.begin(), parms.plain_modulus());
-    parms.set_coeff_modulus(coeff_modulus);
+    EncryptionParameters parms = params.encryption_parameters();
+    const vector<Modulus> &coeff_modulus = parms.coeff_modulus();
 
     SEALContext context(parms);
     auto &context_data = *context.get_context_data(parms.parms_id());
 
     cout << "Plaintext modulus: " << coeff_modulus[0].value() << "\n";
+    cout << "Parameters: " << params << "\n";
+    cout << "Threads: " << options.threads << "\n";
+    cout << "Kernels: " << select_kernels(context_data).name << "\n";
     cout << "===================\n";
 
     auto prng = UniformRandomGeneratorFactory::DefaultFactory()->create();
 
-    BatchSelect bs(context_data, prng);
+    BatchSelect bs(params, context_data, prng, options.threads);
+    bs.digest_cache = options.digest_cache;
 
     FILE *f_pp = fopen("pp.bin", "rb");
     bs.read_pp(f_pp);
@@ -36,25 +38,26 @@ int main()
     bs.read_st2(f_st2);
     fclose(f_st2);
 
-    Pointer<uint64_t> y(allocate_zero_uint(w*poly_modulus_degree, MemoryManager::GetPool()));
-    ifstream f_y;
-    f_y.open("y.txt");
-    for (size_t i = 0; i < w*poly_modulus_degree; ++i) {
-        f_y >> y[i];
+    vector<Pointer<uint64_t>> ys(options.queries), sks;
+    for (size_t q = 0; q < options.queries; ++q) {
+        ys[q] = allocate_zero_uint(params.label_count(), MemoryManager::GetPool());
+        read_labels(label_path(query_name("y", options, q), options.binary_labels), options.binary_labels, ys[q].get(), params.label_count(), 1, *bs.pool);
     }
-    f_y.close();
 
     auto begin = chrono::steady_clock::now();
 
-    bs.keygen(y);
+    bs.keygen_many(ys, sks);
     
     cout << "===================\n";
     cout << "Total time: " << time_str(chrono::steady_clock::now() - begin) << ".\n";
     print_statistics();
 
-    FILE *f_sk = fopen("sk.bin", "wb");
-    bs.save_sk(f_sk);
-    fclose(f_sk);
+    for (size_t q = 0; q < options.queries; ++q) {
+        bs.set_sk(sks[q]);
+        FILE *f_sk = fopen((query_name("sk", options, q) + ".bin").c_str(), "w+b");
+        bs.save_sk(f_sk, options.packed);
+        fclose(f_sk);
+    }
 
     return 0;
 }
@@ -0,0 +1,245 @@
+#include "labels.h"
+#include "mappedfile.h"
+#include "packing.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+// "TLLABELS" in little endian
+constexpr uint64_t labels_marker = 0x534c4542414c4c54;
+
+constexpr size_t header_words = 3;
+
+size_t packed_words(size_t count, int bits) {
+    return (count*bits + 63) / 64;
+}
+
+void check_bits(int bits) {
+    if (bits < 1 || bits > 63) {
+        throw invalid_argument("labels need to have between 1 and 63 bits");
+    }
+}
+
+void write_file(const string &path, const void *data, size_t size) {
+    FILE *f = fopen(path.c_str(), "wb");
+    if (!f) {
+        throw runtime_error("cannot open " + path);
+    }
+    size_t written = fwrite(data, 1, size, f);
+    if (fclose(f) || written != size) {
+        throw runtime_error("cannot write " + path);
+    }
+}
+
+inline bool is_space(char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' || c == '\f';
+}
+
+/*
+Text files are parsed in parallel: the file is split into one part per thread, each part
+starting after a newline, and every thread parses the values of its part into its own vector.
+The values are then copied to their positions, which are known once all parts are parsed.
+Like reading with operator>>, any whitespace separates values, and values after the first
+count are ignored.
+*/
+void read_text(const string &path, uint64_t *data, size_t count, ThreadPool &pool) {
+    MappedFile file(path);
+    const char *text = reinterpret_cast<const char *>(file.data());
+    size_t size = file.size();
+
+    size_t parts = pool.size();
+    vector<size_t> bounds(parts + 1, size);
+    bounds[0] = 0;
+    for (size_t i = 1; i < parts; ++i) {
+        const char *newline = static_cast<const char *>(memchr(text + i*size/parts, '\n', size - i*size/parts));
+        bounds[i] = max(bounds[i - 1], newline ? static_cast<size_t>(newline - text) + 1 : size);
+    }
+
+    vector<vector<uint64_t>> values(parts);
+    pool.parallel_for(parts, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            const char *p = text + bounds[i], *last = text + bounds[i + 1];
+            values[i].reserve((last - p) / 2);
+            for (;;) {
+                while (p < last && is_space(*p)) ++p;
+                if (p == last) break;
+                uint64_t value;
+                auto result = from_chars(p, last, value);
+                if (result.ec != errc() || (result.ptr < last && !is_space(*result.ptr))) {
+                    throw runtime_error(path + " contains an invalid value");
+                }
+                values[i].push_back(value);
+                p = result.ptr;
+            }
+        }
+    });
+
+    vector<size_t> offsets(parts + 1, 0);
+    for (size_t i = 0; i < parts; ++i) {
+        offsets[i + 1] = offsets[i] + values[i].size();
+    }
+    if (offsets[parts] < count) {
+        throw runtime_error(path + " contains " + to_string(offsets[parts]) + " values, expected " + to_string(count));
+    }
+    pool.parallel_for(parts, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            if (offsets[i] < count) {
+                copy_n(values[i].data(), min(values[i].size(), count - offsets[i]), data + offsets[i]);
+            }
+        }
+    });
+}
+
+// Formats the values in parallel, each thread into its own part of text, and returns the length of the text.
+size_t format_text(const uint64_t *data, size_t count, unique_ptr<char[]> &text, ThreadPool &pool) {
+    constexpr size_t max_chars = 21; // at most 20 digits and a newline per value
+    size_t parts = pool.size();
+    text.reset(new char[count*max_chars + 1]);
+    vector<size_t> ends(parts);
+    pool.parallel_for(parts, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            size_t first = i*count/parts, last = (i + 1)*count/parts;
+            char *p = text.get() + first*max_chars;
+            for (size_t k = first; k < last; ++k) {
+                p = to_chars(p, p + max_chars, data[k]).ptr;
+                *p++ = '\n';
+            }
+            ends[i] = static_cast<size_t>(p - text.get());
+        }
+    });
+
+    // move the parts together; each part only moves towards the front
+    size_t size = ends[0];
+    for (size_t i = 1; i < parts; ++i) {
+        size_t first = i*count/parts*max_chars;
+        memmove(text.get() + size, text.get() + first, ends[i] - first);
+        size += ends[i] - first;
+    }
+    return size;
+}
+
+// packs count values into ceil(count*bits/64) words at packed; blocks of 64 values are packed in parallel
+void pack_labels(const uint64_t *data, size_t count, int bits, uint64_t *packed, ThreadPool &pool) {
+    pool.parallel_for((count + 63) / 64, [&](size_t begin, size_t end) {
+        size_t first = begin*64;
+        pack_bits(data + first, min(end*64, count) - first, bits, packed + begin*bits);
+    });
+}
+
+void write_text(const string &path, const uint64_t *data, size_t count, ThreadPool &pool) {
+    unique_ptr<char[]> text;
+    size_t size = format_text(data, count, text, pool);
+    write_file(path, text.get(), size);
+}
+
+} // namespace
+
+string label_path(const string &name, bool binary) {
+    return name + (binary ? ".bin" : ".txt");
+}
+
+void read_labels(const string &path, bool binary, uint64_t *data, size_t count, int bits, ThreadPool &pool) {
+    if (!binary) {
+        read_text(path, data, count, pool);
+        return;
+    }
+
+    check_bits(bits);
+    MappedFile file(path);
+    uint64_t head[header_words] = {};
+    if (file.size() >= sizeof(head)) {
+        memcpy(head, file.data(), sizeof(head));
+    }
+    if (head[0] != labels_marker) {
+        throw runtime_error(path + " is not a binary label file");
+    }
+    if (head[1] != count || head[2] != static_cast<uint64_t>(bits)) {
+        throw runtime_error(path + " contains " + to_string(head[1]) + " values of " + to_string(head[2])
+            + " bits, expected " + to_string(count) + " values of " + to_string(bits) + " bits");
+    }
+    if ((file.size() - sizeof(head)) / 8 < packed_words(count, bits)) {
+        throw runtime_error(path + " is too short");
+    }
+
+    // every 64 values fill exactly bits words, so blocks of 64 values are unpacked independently
+    const uint64_t *packed = reinterpret_cast<const uint64_t *>(file.data()) + header_words;
+    pool.parallel_for((count + 63) / 64, [&](size_t begin, size_t end) {
+        size_t first = begin*64;
+        unpack_bits(packed + begin*bits, min(end*64, count) - first, bits, data + first);
+    });
+}
+
+void write_labels(const string &path, bool binary, const uint64_t *data, size_t count, int bits, ThreadPool &pool) {
+    if (!binary) {
+        write_text(path, data, count, pool);
+        return;
+    }
+
+    check_bits(bits);
+    vector<uint64_t> buffer(header_words + packed_words(count, bits));
+    buffer[0] = labels_marker;
+    buffer[1] = count;
+    buffer[2] = static_cast<uint64_t>(bits);
+    pack_labels(data, count, bits, buffer.data() + header_words, pool);
+
+    write_file(path, buffer.data(), buffer.size()*8);
+}
+
+LabelWriter::LabelWriter(const string &path, bool binary, size_t count, int bits)
+    : path_(path), binary_(binary), remaining_(count), bits_(bits) {
+    if (binary) check_bits(bits);
+    f_ = fopen(path.c_str(), "wb");
+    if (!f_) {
+        throw runtime_error("cannot open " + path);
+    }
+    if (binary) {
+        uint64_t head[header_words] = { labels_marker, count, static_cast<uint64_t>(bits) };
+        failed_ = fwrite(head, 8, header_words, f_) != header_words;
+    }
+}
+
+LabelWriter::~LabelWriter() {
+    if (f_) fclose(f_);
+}
+
+void LabelWriter::append(const uint64_t *data, size_t count, ThreadPool &pool) {
+    if (count > remaining_) {
+        throw logic_error("more labels appended than announced");
+    }
+    if (count < remaining_ && count % 64) {
+        throw logic_error("all parts but the last need to have a multiple of 64 labels");
+    }
+    remaining_ -= count;
+
+    if (binary_) {
+        vector<uint64_t> packed(packed_words(count, bits_));
+        pack_labels(data, count, bits_, packed.data(), pool);
+        failed_ = failed_ || fwrite(packed.data(), 8, packed.size(), f_) != packed.size();
+    } else {
+        unique_ptr<char[]> text;
+        size_t size = format_text(data, count, text, pool);
+        failed_ = failed_ || fwrite(text.get(), 1, size, f_) != size;
+    }
+}
+
+void LabelWriter::finish() {
+    FILE *f = f_;
+    f_ = nullptr;
+    if (fclose(f) || failed_) {
+        throw runtime_error("cannot write " + path_);
+    }
+    if (remaining_) {
+        throw logic_error("fewer labels appended than announced");
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "threadpool.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+/**
+Files of labels (l1, l2, the output, and the selection vector y), in text or binary form.
+
+A text file has one decimal value per line. A binary file consists of a header of three
+little-endian 64-bit words (a marker, the number of values, and the number of bits per
+value), followed by the values packed with pack_bits (see packing.h); the labels take the
+bit length of the plaintext modulus, and y takes one bit per entry, i.e., it is a bitset.
+Binary files are read by mapping them and written with a single write.
+*/
+
+// Path of the file with the given base name (like "l1"): "<name>.txt" or "<name>.bin".
+std::string label_path(const std::string &name, bool binary);
+
+/**
+Reads count values into data. For binary files, throws std::runtime_error if the file cannot
+be read, or does not contain count values of the given number of bits.
+*/
+void read_labels(const std::string &path, bool binary, std::uint64_t *data, std::size_t count, int bits, ThreadPool &pool);
+
+// Writes count values of at most bits bits each.
+void write_labels(const std::string &path, bool binary, const std::uint64_t *data, std::size_t count, int bits, ThreadPool &pool);
+
+/**
+Writes a file of count values in parts, in the same form as write_labels: every part is
+appended (formatted or packed in parallel) as soon as it is given. All parts but the last
+need to consist of a multiple of 64 values, so that packed parts start at whole words.
+*/
+class LabelWriter {
+public:
+
+    // Opens the file; throws std::runtime_error if it cannot be opened.
+    LabelWriter(const std::string &path, bool binary, std::size_t count, int bits);
+    ~LabelWriter();
+
+    LabelWriter(const LabelWriter &) = delete;
+    LabelWriter &operator=(const LabelWriter &) = delete;
+
+    void append(const std::uint64_t *data, std::size_t count, ThreadPool &pool);
+    /**
+    Closes the file. Throws std::runtime_error if writing failed, and std::logic_error if not
+    all count values were appended.
+    */
+    void finish();
+
+private:
+    std::string path_;
+    bool binary_;
+    std::size_t remaining_;
+    int bits_;
+    FILE *f_;
+    bool failed_ = false;
+};
@@ -0,0 +1,102 @@
+#include "mappedfile.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define TINYLABELS_USE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+#ifdef TINYLABELS_USE_MMAP
+
+MappedFile::MappedFile(const string &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw runtime_error("cannot open " + path + ": " + strerror(errno));
+    }
+    struct stat st;
+    if (fstat(fd, &st)) {
+        int error = errno;
+        close(fd);
+        throw runtime_error("cannot open " + path + ": " + strerror(error));
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    if (size_) {
+        void *data = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            int error = errno;
+            close(fd);
+            throw runtime_error("cannot map " + path + ": " + strerror(error));
+        }
+        data_ = static_cast<uint8_t *>(data);
+    }
+    // the mapping stays valid after closing the file
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (data_) munmap(data_, size_);
+}
+
+namespace {
+
+void advise(uint8_t *data, size_t size, const void *ptr, size_t bytes, int advice) {
+    if (!data || !bytes) return;
+    // ranges outside of the mapping are ignored, as are the parts past its end
+    uintptr_t address = reinterpret_cast<uintptr_t>(ptr), start = reinterpret_cast<uintptr_t>(data);
+    if (address < start || address - start >= size) return;
+    size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t begin = static_cast<size_t>(address - start);
+    size_t end = begin + min(bytes, size - begin);
+    begin -= begin % page_size;
+    madvise(data + begin, end - begin, advice);
+}
+
+} // namespace
+
+void MappedFile::will_need(const void *ptr, size_t bytes) const {
+    advise(data_, size_, ptr, bytes, MADV_WILLNEED);
+}
+
+void MappedFile::sequential(const void *ptr, size_t bytes) const {
+    advise(data_, size_, ptr, bytes, MADV_SEQUENTIAL);
+}
+
+void MappedFile::dont_need(const void *ptr, size_t bytes) const {
+    advise(data_, size_, ptr, bytes, MADV_DONTNEED);
+}
+
+#else
+
+MappedFile::MappedFile(const string &path) {
+    ifstream in(path, ios::binary | ios::ate);
+    if (!in) {
+        throw runtime_error("cannot open " + path);
+    }
+    size_ = static_cast<size_t>(in.tellg());
+    buffer_.resize(size_);
+    in.seekg(0);
+    if (!in.read(reinterpret_cast<char *>(buffer_.data()), size_)) {
+        throw runtime_error("cannot read " + path);
+    }
+    data_ = buffer_.data();
+}
+
+MappedFile::~MappedFile() {}
+
+void MappedFile::will_need(const void *, size_t) const {}
+
+void MappedFile::sequential(const void *, size_t) const {}
+
+void MappedFile::dont_need(const void *, size_t) const {}
+
+#endif
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+A file mapped into memory, for loading large files (like ct1.bin) without copying them.
+
+The mapping is private (copy-on-write): the data may be modified in memory, but changes
+are never written back to the file. Pages are only read from disk when they are accessed,
+and processes mapping the same file share the pages that they have not modified. On
+platforms without mmap, the file is read into memory instead.
+*/
+class MappedFile {
+public:
+
+    // Throws std::runtime_error if the file cannot be opened or mapped.
+    explicit MappedFile(const std::string &path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    std::uint8_t *data() const {
+        return data_;
+    }
+    std::size_t size() const {
+        return size_;
+    }
+
+    /**
+    Read-ahead hints for the range [ptr, ptr + bytes) of the mapping (the range is extended
+    to whole pages). will_need starts reading the range in the background, and sequential
+    announces that the range will be read in increasing order, so that the kernel reads
+    ahead aggressively. Both are no-ops without mmap, and for ranges that do not start inside
+    the mapping.
+    */
+    void will_need(const void *ptr, std::size_t bytes) const;
+    void sequential(const void *ptr, std::size_t bytes) const;
+    /**
+    Drops the pages of the range from memory, so that they no longer count as resident; they
+    are read from the file again if they are accessed later. Changes to these pages are lost,
+    so this is only for ranges that were not modified. No-op without mmap, and for ranges
+    that do not start inside the mapping.
+    */
+    void dont_need(const void *ptr, std::size_t bytes) const;
+
+private:
+    std::uint8_t *data_ = nullptr;
+    std::size_t size_ = 0;
+    std::vector<std::uint8_t> buffer_; // only used without mmap
+};
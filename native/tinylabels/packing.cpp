@@ -0,0 +1,360 @@
+#include "packing.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+using namespace std;
+using namespace seal;
+
+namespace {
+
+// "TLPACKED" in little endian; all coefficients are below 2^62
+constexpr uint64_t packed_marker = 0x44454b4341504c54;
+
+// number of polynomials packed or unpacked at a time when streaming
+constexpr size_t chunk_polys = 64;
+
+/*
+A group of 64 coefficients of BITS bits fills exactly BITS words. Within a group, the word and
+the shift of every coefficient are compile-time constants, so the group is packed (or unpacked)
+by straight-line code without branches or loop-carried state, which the compiler can schedule
+freely and vectorize.
+*/
+template <int BITS, size_t J>
+inline void pack_coefficient(const uint64_t *in, uint64_t *out) {
+    constexpr uint64_t mask = (uint64_t(1) << BITS) - 1;
+    constexpr size_t word = J*BITS / 64, shift = J*BITS % 64;
+    uint64_t c = in[J] & mask;
+    out[word] |= c << shift;
+    if constexpr (shift + BITS > 64) {
+        out[word + 1] |= c >> (64 - shift);
+    }
+}
+
+template <int BITS, size_t... J>
+inline void pack_group(const uint64_t *in, uint64_t *out, index_sequence<J...>) {
+    for (size_t i = 0; i < BITS; ++i) out[i] = 0;
+    (pack_coefficient<BITS, J>(in, out), ...);
+}
+
+template <int BITS, size_t J>
+inline void unpack_coefficient(const uint64_t *in, uint64_t *out) {
+    constexpr uint64_t mask = (uint64_t(1) << BITS) - 1;
+    constexpr size_t word = J*BITS / 64, shift = J*BITS % 64;
+    if constexpr (shift + BITS > 64) {
+        out[J] = ((in[word] >> shift) | (in[word + 1] << (64 - shift))) & mask;
+    } else {
+        out[J] = (in[word] >> shift) & mask;
+    }
+}
+
+template <int BITS, size_t... J>
+inline void unpack_group(const uint64_t *in, uint64_t *out, index_sequence<J...>) {
+    (unpack_coefficient<BITS, J>(in, out), ...);
+}
+
+/*
+Packs n coefficients of BITS bits each into ceil(n*BITS/64) words: whole groups of 64
+coefficients as above, and the remaining ones (fewer than 64, starting at a word boundary)
+one at a time.
+*/
+template <int BITS>
+void pack_limb(const uint64_t *in, size_t n, uint64_t *out) {
+    constexpr uint64_t mask = (uint64_t(1) << BITS) - 1;
+    size_t groups = n / 64;
+    for (size_t g = 0; g < groups; ++g) {
+        pack_group<BITS>(in + g*64, out + g*BITS, make_index_sequence<64>());
+    }
+    in += groups*64;
+    out += groups*BITS;
+    n -= groups*64;
+
+    uint64_t acc = 0;
+    int filled = 0;
+    for (size_t k = 0; k < n; ++k) {
+        uint64_t c = in[k] & mask;
+        acc |= c << filled;
+        filled += BITS;
+        if (filled >= 64) {
+            *out++ = acc;
+            filled -= 64;
+            acc = filled ? c >> (BITS - filled) : 0;
+        }
+    }
+    if (filled) *out = acc;
+}
+
+template <int BITS>
+void unpack_limb(const uint64_t *in, size_t n, uint64_t *out) {
+    constexpr uint64_t mask = (uint64_t(1) << BITS) - 1;
+    size_t groups = n / 64;
+    for (size_t g = 0; g < groups; ++g) {
+        unpack_group<BITS>(in + g*BITS, out + g*64, make_index_sequence<64>());
+    }
+    in += groups*BITS;
+    out += groups*64;
+    n -= groups*64;
+
+    if (!n) return;
+    uint64_t acc = *in++;
+    int available = 64;
+    for (size_t k = 0; k < n; ++k) {
+        if (available >= BITS) {
+            out[k] = acc & mask;
+            acc >>= BITS;
+            available -= BITS;
+        } else {
+            uint64_t next = *in++;
+            out[k] = (acc | (next << available)) & mask;
+            acc = next >> (BITS - available);
+            available += 64 - BITS;
+        }
+    }
+}
+
+using limb_function = void (*)(const uint64_t *, size_t, uint64_t *);
+
+template <size_t... I>
+constexpr array<pair<limb_function, limb_function>, sizeof...(I)> make_limb_functions(index_sequence<I...>) {
+    return {{ { pack_limb<I + 1>, unpack_limb<I + 1> }... }};
+}
+
+// pack and unpack functions for 1 to 63 bits
+constexpr auto limb_functions = make_limb_functions(make_index_sequence<63>());
+
+size_t limb_words(size_t poly_modulus_degree, int bits) {
+    return (poly_modulus_degree * bits + 63) / 64;
+}
+
+vector<uint64_t> header(size_t count, const PolyFormat &format) {
+    vector<uint64_t> result{ packed_marker, count, format.bit_counts.size() };
+    result.insert(result.end(), format.bit_counts.begin(), format.bit_counts.end());
+    return result;
+}
+
+void check_header(const uint64_t *words, size_t count, const PolyFormat &format) {
+    vector<uint64_t> expected = header(count, format);
+    if (!equal(expected.begin(), expected.end(), words)) {
+        throw runtime_error("packed polynomials do not match the parameters");
+    }
+}
+
+} // namespace
+
+PolyFormat::PolyFormat(size_t poly_modulus_degree, const vector<Modulus> &coeff_modulus)
+    : poly_modulus_degree(poly_modulus_degree) {
+    for (const Modulus &modulus : coeff_modulus) {
+        int bits = modulus.bit_count();
+        if (bits < 1 || bits > 63) {
+            throw invalid_argument("moduli need to have between 1 and 63 bits");
+        }
+        bit_counts.push_back(bits);
+    }
+}
+
+size_t PolyFormat::packed_poly_words() const {
+    size_t result = 0;
+    for (int bits : bit_counts) {
+        result += limb_words(poly_modulus_degree, bits);
+    }
+    return result;
+}
+
+void pack_bits(const uint64_t *in, size_t n, int bits, uint64_t *out) {
+    limb_functions[bits - 1].first(in, n, out);
+}
+
+void unpack_bits(const uint64_t *in, size_t n, int bits, uint64_t *out) {
+    limb_functions[bits - 1].second(in, n, out);
+}
+
+void PolyFormat::pack(const uint64_t *in, uint64_t *out) const {
+    for (int bits : bit_counts) {
+        pack_bits(in, poly_modulus_degree, bits, out);
+        in += poly_modulus_degree;
+        out += limb_words(poly_modulus_degree, bits);
+    }
+}
+
+void PolyFormat::unpack(const uint64_t *in, uint64_t *out) const {
+    for (int bits : bit_counts) {
+        unpack_bits(in, poly_modulus_degree, bits, out);
+        in += limb_words(poly_modulus_degree, bits);
+        out += poly_modulus_degree;
+    }
+}
+
+void save_polys(FILE* f, const uint64_t *data, size_t count, const PolyFormat &format, bool packed, ThreadPool &pool) {
+    size_t poly_words = format.poly_words();
+    if (!packed) {
+        fwrite(data, 8, count*poly_words, f);
+        return;
+    }
+
+    vector<uint64_t> head = header(count, format);
+    fwrite(head.data(), 8, head.size(), f);
+
+    size_t packed_words = format.packed_poly_words();
+    vector<uint64_t> buffer(min(count, chunk_polys)*packed_words);
+    for (size_t first = 0; first < count; first += chunk_polys) {
+        size_t n = min(chunk_polys, count - first);
+        pool.parallel_for(n, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                format.pack(data + (first + i)*poly_words, buffer.data() + i*packed_words);
+            }
+        });
+        fwrite(buffer.data(), 8, n*packed_words, f);
+    }
+}
+
+AsyncPolyWriter::AsyncPolyWriter(FILE* f, size_t count, const PolyFormat &format, bool packed, size_t batch_polys)
+    : f_(f), remaining_(count), format_(format), packed_(packed), batch_polys_(batch_polys) {
+    if (!batch_polys) throw invalid_argument("batch_polys needs to be positive");
+    for (auto &buffer : buffers_) {
+        buffer.resize(batch_polys*format.poly_words());
+    }
+    if (packed) {
+        vector<uint64_t> head = header(count, format);
+        fwrite(head.data(), 8, head.size(), f);
+        packed_buffer_.resize(batch_polys*format.packed_poly_words());
+    }
+    writer_ = thread([this] { write_loop(); });
+}
+
+AsyncPolyWriter::~AsyncPolyWriter() {
+    {
+        lock_guard<mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    writer_.join();
+}
+
+uint64_t *AsyncPolyWriter::buffer() {
+    unique_lock<mutex> lock(mutex_);
+    // the buffers are written in the order they were committed, so the one to fill is free
+    // as soon as at most one buffer is queued
+    cv_.wait(lock, [this] { return queued_ < 2; });
+    return buffers_[filling_].data();
+}
+
+void AsyncPolyWriter::commit(size_t n) {
+    if (n > batch_polys_) throw invalid_argument("batch is too large");
+    {
+        lock_guard<mutex> lock(mutex_);
+        if (n > remaining_) throw logic_error("more polynomials committed than announced");
+        remaining_ -= n;
+        sizes_[filling_] = n;
+        filling_ ^= 1;
+        ++queued_;
+    }
+    cv_.notify_all();
+}
+
+void AsyncPolyWriter::finish() {
+    unique_lock<mutex> lock(mutex_);
+    cv_.wait(lock, [this] { return !queued_; });
+    if (failed_) throw runtime_error("cannot write polynomials");
+    if (remaining_) throw logic_error("fewer polynomials committed than announced");
+    fflush(f_);
+}
+
+void AsyncPolyWriter::write_loop() {
+    size_t poly_words = format_.poly_words(), packed_words = format_.packed_poly_words();
+    for (size_t writing = 0;; writing ^= 1) {
+        {
+            unique_lock<mutex> lock(mutex_);
+            cv_.wait(lock, [this] { return stop_ || queued_; });
+            if (!queued_) return;
+        }
+
+        // the caller does not touch this buffer until it is released below
+        const uint64_t *data = buffers_[writing].data();
+        size_t n = sizes_[writing];
+        bool ok;
+        if (packed_) {
+            for (size_t i = 0; i < n; ++i) {
+                format_.pack(data + i*poly_words, packed_buffer_.data() + i*packed_words);
+            }
+            ok = fwrite(packed_buffer_.data(), 8, n*packed_words, f_) == n*packed_words;
+        } else {
+            ok = fwrite(data, 8, n*poly_words, f_) == n*poly_words;
+        }
+
+        {
+            lock_guard<mutex> lock(mutex_);
+            failed_ = failed_ || !ok;
+            --queued_;
+        }
+        cv_.notify_all();
+    }
+}
+
+void read_polys(FILE* f, uint64_t *data, size_t count, const PolyFormat &format, ThreadPool &pool) {
+    size_t poly_words = format.poly_words();
+    uint64_t marker = 0;
+    if (fread(&marker, 8, 1, f) != 1 || marker != packed_marker) {
+        fseek(f, -(long)sizeof(marker), SEEK_CUR);
+        if (fread(data, 8, count*poly_words, f) != count*poly_words) {
+            throw runtime_error("file is too short");
+        }
+        return;
+    }
+
+    vector<uint64_t> head(header(count, format).size());
+    head[0] = marker;
+    if (fread(head.data() + 1, 8, head.size() - 1, f) != head.size() - 1) {
+        throw runtime_error("file is too short");
+    }
+    check_header(head.data(), count, format);
+
+    size_t packed_words = format.packed_poly_words();
+    vector<uint64_t> buffer(min(count, chunk_polys)*packed_words);
+    for (size_t first = 0; first < count; first += chunk_polys) {
+        size_t n = min(chunk_polys, count - first);
+        if (fread(buffer.data(), 8, n*packed_words, f) != n*packed_words) {
+            throw runtime_error("file is too short");
+        }
+        pool.parallel_for(n, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                format.unpack(buffer.data() + i*packed_words, data + (first + i)*poly_words);
+            }
+        });
+    }
+}
+
+bool is_packed(const uint8_t *in, size_t size) {
+    uint64_t marker = 0;
+    return size >= 8 && (memcpy(&marker, in, 8), marker == packed_marker);
+}
+
+size_t unpack_polys(const uint8_t *in, size_t size, uint64_t *data, size_t count, const PolyFormat &format, ThreadPool &pool) {
+    if (!is_packed(in, size)) {
+        return 0;
+    }
+    if (reinterpret_cast<uintptr_t>(in) % alignof(uint64_t)) {
+        throw runtime_error("packed polynomials are not aligned");
+    }
+
+    size_t head_words = header(count, format).size();
+    size_t packed_words = format.packed_poly_words();
+    if (size / 8 < head_words || (size / 8 - head_words) / packed_words < count) {
+        throw runtime_error("file is too short");
+    }
+    vector<uint64_t> head(head_words);
+    memcpy(head.data(), in, head_words*8);
+    check_header(head.data(), count, format);
+
+    // the packed data is a multiple of 8 bytes after an 8-byte aligned header
+    const uint64_t *packed = reinterpret_cast<const uint64_t *>(in) + head_words;
+    size_t poly_words = format.poly_words();
+    pool.parallel_for(count, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            format.unpack(packed + i*packed_words, data + i*poly_words);
+        }
+    });
+    return (head_words + count*packed_words)*8;
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#include "threadpool.h"
+#include "seal/seal.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+Storage of polynomial arrays in files.
+
+Polynomials are either stored as they are in memory (one 8-byte word per coefficient), or
+in packed form, where the coefficients modulo coeff_modulus[r] take exactly as many bits as
+coeff_modulus[r]. A packed array starts with a header (a marker word, which is larger than
+any coefficient, the number of polynomials, the number of moduli and their bit counts),
+followed by the polynomials; each limb of a polynomial is a bit stream padded to whole
+words. Readers recognize packed arrays by the marker, so both forms can be read the same way.
+*/
+struct PolyFormat {
+    std::size_t poly_modulus_degree;
+    std::vector<int> bit_counts; // one per modulus
+
+    PolyFormat(std::size_t poly_modulus_degree, const std::vector<seal::Modulus> &coeff_modulus);
+
+    // number of words of one polynomial in memory
+    std::size_t poly_words() const {
+        return poly_modulus_degree * bit_counts.size();
+    }
+    // number of words of one packed polynomial
+    std::size_t packed_poly_words() const;
+
+    // Packs one polynomial from in (poly_words() words) into out (packed_poly_words() words), and back.
+    void pack(const std::uint64_t *in, std::uint64_t *out) const;
+    void unpack(const std::uint64_t *in, std::uint64_t *out) const;
+};
+
+/**
+Packs n values of bits bits each (1 <= bits <= 63) into ceil(n*bits/64) words, and back;
+higher bits of the values are ignored. Packing starts a new word every 64 values, so ranges
+of multiples of 64 values can be packed independently.
+*/
+void pack_bits(const std::uint64_t *in, std::size_t n, int bits, std::uint64_t *out);
+void unpack_bits(const std::uint64_t *in, std::size_t n, int bits, std::uint64_t *out);
+
+/**
+Writes count polynomials starting at data to f, packed or not. Packing is done in chunks
+of polynomials, which are packed in parallel on pool.
+*/
+void save_polys(FILE* f, const std::uint64_t *data, std::size_t count, const PolyFormat &format, bool packed, ThreadPool &pool);
+
+/**
+Writes count polynomials to f in the same form as save_polys, while they are being computed.
+The caller fills a buffer of up to batch_polys polynomials, and hands it to a writer thread,
+which packs (if needed) and writes it while the caller fills the other buffer. At most two
+batches are held in memory, independently of count.
+*/
+class AsyncPolyWriter {
+public:
+
+    AsyncPolyWriter(FILE* f, std::size_t count, const PolyFormat &format, bool packed, std::size_t batch_polys);
+    // Waits for the writer thread; call finish to see whether all polynomials were written.
+    ~AsyncPolyWriter();
+
+    AsyncPolyWriter(const AsyncPolyWriter &) = delete;
+    AsyncPolyWriter &operator=(const AsyncPolyWriter &) = delete;
+
+    std::size_t batch_polys() const {
+        return batch_polys_;
+    }
+
+    // Returns the buffer for the next batch, after waiting until its previous batch is written.
+    std::uint64_t *buffer();
+    // Queues the first n polynomials of the buffer for writing.
+    void commit(std::size_t n);
+    /**
+    Waits until all queued polynomials are written. Throws std::runtime_error if writing
+    failed, or if the number of committed polynomials is not count.
+    */
+    void finish();
+
+private:
+    void write_loop();
+
+    FILE* f_;
+    std::size_t remaining_;
+    PolyFormat format_;
+    bool packed_;
+    std::size_t batch_polys_;
+
+    std::vector<std::uint64_t> buffers_[2];
+    std::size_t sizes_[2] = { 0, 0 };
+    std::vector<std::uint64_t> packed_buffer_;
+    std::size_t filling_ = 0; // the buffer that buffer() returns
+    std::size_t queued_ = 0;  // the number of committed buffers that are not written yet
+    bool stop_ = false;
+    bool failed_ = false;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::thread writer_;
+};
+
+/**
+Reads count polynomials in either form from f into data. Throws std::runtime_error if the
+file is too short or was packed for a different number of polynomials or other moduli.
+*/
+void read_polys(FILE* f, std::uint64_t *data, std::size_t count, const PolyFormat &format, ThreadPool &pool);
+
+// Returns whether the memory range [in, in + size) starts with packed polynomials.
+bool is_packed(const std::uint8_t *in, std::size_t size);
+
+/**
+If the memory range [in, in + size) starts with count packed polynomials, unpacks them into
+data and returns the number of bytes read; returns 0 if the polynomials are not packed.
+*/
+std::size_t unpack_polys(const std::uint8_t *in, std::size_t size, std::uint64_t *data, std::size_t count, const PolyFormat &format, ThreadPool &pool);
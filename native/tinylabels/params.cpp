@@ -0,0 +1,227 @@
+#include "params.h"
+#include "threadpool.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+using namespace seal;
+
+namespace {
+
+size_t parse_size(const string &name, const string &value) {
+    size_t pos = 0;
+    unsigned long long result = 0;
+    try {
+        result = stoull(value, &pos);
+    } catch (const exception &) {
+        pos = 0;
+    }
+    if (!pos || pos != value.size()) {
+        throw invalid_argument("invalid value for " + name + ": " + value);
+    }
+    return static_cast<size_t>(result);
+}
+
+string trim(const string &s) {
+    size_t begin = s.find_first_not_of(" \t\r");
+    if (begin == string::npos) return "";
+    size_t end = s.find_last_not_of(" \t\r");
+    return s.substr(begin, end - begin + 1);
+}
+
+// the encryption parameters for params, without checking them
+EncryptionParameters build_encryption_parameters(const BatchSelectParams &params) {
+    size_t poly_modulus_degree = params.poly_modulus_degree;
+    EncryptionParameters parms(scheme_type::onoff);
+    parms.set_poly_modulus_degree(poly_modulus_degree);
+    parms.set_plain_modulus(PlainModulus::Batching(poly_modulus_degree, (int)params.mod_plaintext));
+
+    vector<Modulus> coeff_modulus = CoeffModulus::Create(poly_modulus_degree, {(int)params.mod_noise});
+    coeff_modulus.insert(coeff_modulus.begin(), parms.plain_modulus());
+    parms.set_coeff_modulus(coeff_modulus);
+
+    return parms;
+}
+
+} // namespace
+
+size_t BatchSelectParams::l() const {
+    size_t result = 0;
+    while (((size_t)1 << result) < w) ++result;
+    return result;
+}
+
+void BatchSelectParams::set(const string &name, const string &value) {
+    if (name == "poly_modulus_degree") poly_modulus_degree = parse_size(name, value);
+    else if (name == "w") w = parse_size(name, value);
+    else if (name == "m") m = parse_size(name, value);
+    else if (name == "log_g") log_g = parse_size(name, value);
+    else if (name == "mod_plaintext") mod_plaintext = parse_size(name, value);
+    else if (name == "mod_noise") mod_noise = parse_size(name, value);
+    else if (name == "gadget") {
+        if (value != "unsigned" && value != "balanced") throw invalid_argument("gadget needs to be unsigned or balanced");
+        balanced = value == "balanced";
+    }
+    else throw invalid_argument("unknown parameter: " + name);
+}
+
+void BatchSelectParams::load(istream &in) {
+    string line;
+    while (getline(in, line)) {
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty()) continue;
+        size_t eq = line.find('=');
+        if (eq == string::npos) {
+            throw invalid_argument("expected \"name = value\": " + line);
+        }
+        set(trim(line.substr(0, eq)), trim(line.substr(eq + 1)));
+    }
+}
+
+void BatchSelectParams::save(ostream &out) const {
+    out << "poly_modulus_degree = " << poly_modulus_degree << "\n";
+    out << "w = " << w << "\n";
+    out << "m = " << m << "\n";
+    out << "log_g = " << log_g << "\n";
+    out << "mod_plaintext = " << mod_plaintext << "\n";
+    out << "mod_noise = " << mod_noise << "\n";
+    out << "gadget = " << (balanced ? "balanced" : "unsigned") << "\n";
+}
+
+void BatchSelectParams::validate() const {
+    if (w < 2 || (w & (w - 1))) {
+        throw invalid_argument("w needs to be a power of 2 (at least 2)");
+    }
+    if (!poly_modulus_degree || (poly_modulus_degree & (poly_modulus_degree - 1))) {
+        throw invalid_argument("poly_modulus_degree needs to be a power of 2");
+    }
+    if (!m || !log_g || log_g >= 64) {
+        throw invalid_argument("m and log_g need to be positive, and log_g at most 63");
+    }
+    if (balanced && log_g > 62) {
+        throw invalid_argument("log_g needs to be at most 62 for balanced digits");
+    }
+    if (m * log_g < mod_plaintext + mod_noise) {
+        throw invalid_argument("g^m needs to exceed the ciphertext modulus (m*log_g >= mod_plaintext + mod_noise)");
+    }
+    if (noise_bits() > static_cast<double>(mod_noise) - 2) {
+        ostringstream message;
+        message << "the decryption error (about " << fixed << setprecision(1) << noise_bits()
+                << " bits) may exceed a quarter of the second prime; increase mod_noise, or decrease log_g (with a larger m), or use gadget = balanced";
+        throw invalid_argument(message.str());
+    }
+
+    // SEAL's own checks (in particular, the security level of N and the modulus), which would
+    // otherwise only fail in the first tool that sets up the NTT tables
+    EncryptionParameters parms;
+    try {
+        parms = build_encryption_parameters(*this);
+    } catch (const logic_error &e) {
+        throw invalid_argument(string("no suitable moduli: ") + e.what());
+    }
+    SEALContext context(parms);
+    if (!context.parameters_set()) {
+        throw invalid_argument(string("the encryption parameters are not supported by SEAL: ") + context.parameter_error_message());
+    }
+}
+
+double BatchSelectParams::noise_bits() const {
+    double terms = static_cast<double>((l()*2*m + m)*poly_modulus_degree);
+    double digit_variance_bits = 2.0*log_g - log2(balanced ? 12.0 : 3.0);
+    return 0.5*(log2(terms) + 2*log2(noise_small_standard_deviation) + digit_variance_bits) + 4;
+}
+
+EncryptionParameters BatchSelectParams::encryption_parameters() const {
+    validate();
+    return build_encryption_parameters(*this);
+}
+
+ostream &operator<<(ostream &out, const BatchSelectParams &params) {
+    return out << "N = " << params.poly_modulus_degree << ", w = " << params.w << ", l = " << params.l()
+               << ", m = " << params.m << ", g = 2^" << params.log_g
+               << (params.balanced ? " (balanced digits)" : "")
+               << ", moduli of " << params.mod_plaintext << " and " << params.mod_noise << " bits";
+}
+
+Options parse_options(int argc, char **argv) {
+    Options options;
+    options.threads = default_thread_count();
+
+    auto usage = [&](ostream &out) {
+        out << "Usage: " << argv[0] << " [--params <file>] [--threads <n>] [--pp seeded|raw] [--format words|packed] [--labels text|binary] [--ct-layout level|leaf] [--digest-cache <file>] [--queries <n>] [--stream-window <blocks>] [--dec-slice <blocks>] [--<name> <value>]...\n"
+            << "Parameters (see BatchSelectParams) and their defaults:\n";
+        BatchSelectParams().save(out);
+    };
+
+    try {
+        for (int i = 1; i < argc; ++i) {
+            string arg = argv[i];
+            if (arg == "--help" || arg == "-h") {
+                usage(cout);
+                exit(0);
+            }
+            if (arg.compare(0, 2, "--")) {
+                throw invalid_argument("unexpected argument: " + arg);
+            }
+            string name = arg.substr(2), value;
+            size_t eq = name.find('=');
+            if (eq != string::npos) {
+                value = name.substr(eq + 1);
+                name = name.substr(0, eq);
+            } else if (i + 1 < argc) {
+                value = argv[++i];
+            } else {
+                throw invalid_argument("missing value for " + arg);
+            }
+
+            if (name == "threads") {
+                options.threads = parse_size(name, value);
+                if (!options.threads) throw invalid_argument("threads needs to be positive");
+            } else if (name == "pp") {
+                if (value != "seeded" && value != "raw") throw invalid_argument("pp needs to be seeded or raw");
+                options.seeded_pp = value == "seeded";
+            } else if (name == "format") {
+                if (value != "words" && value != "packed") throw invalid_argument("format needs to be words or packed");
+                options.packed = value == "packed";
+            } else if (name == "labels") {
+                if (value != "text" && value != "binary") throw invalid_argument("labels needs to be text or binary");
+                options.binary_labels = value == "binary";
+            } else if (name == "ct-layout") {
+                if (value != "level" && value != "leaf") throw invalid_argument("ct-layout needs to be level or leaf");
+                options.leaf_major = value == "leaf";
+            } else if (name == "digest-cache") {
+                options.digest_cache = value;
+            } else if (name == "queries") {
+                options.queries = parse_size(name, value);
+                if (!options.queries) throw invalid_argument("queries needs to be positive");
+            } else if (name == "stream-window") {
+                options.stream_window = parse_size(name, value);
+            } else if (name == "dec-slice") {
+                options.dec_slice = parse_size(name, value);
+            } else if (name == "params") {
+                ifstream in(value);
+                if (!in) throw invalid_argument("cannot open parameter file " + value);
+                options.params.load(in);
+            } else {
+                options.params.set(name, value);
+            }
+        }
+        options.params.validate();
+        if (options.dec_slice && options.queries > 1) throw invalid_argument("dec-slice needs a single query");
+    } catch (const invalid_argument &e) {
+        cerr << "Error: " << e.what() << "\n";
+        usage(cerr);
+        exit(1);
+    }
+
+    return options;
+}
+
+string query_name(const string &name, const Options &options, size_t q) {
+    return options.queries == 1 ? name : name + to_string(q);
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "seal/seal.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+// the errors of the ciphertexts (discrete Gaussians, clipped at max_deviation)
+constexpr double noise_small_standard_deviation = 4;
+constexpr double noise_small_max_deviation = 128 * noise_small_standard_deviation;
+
+constexpr double noise_large_standard_deviation = 1000;
+constexpr double noise_large_max_deviation = 128 * noise_large_standard_deviation;
+
+/**
+The parameter set of a BatchSelect instance. All tools working on the same files
+need to use the same parameters.
+*/
+struct BatchSelectParams {
+    std::size_t poly_modulus_degree = 4096;
+    std::size_t w = 512;             // number of blocks; needs to be a power of 2
+    std::size_t m = 4;               // number of gadget digits, s.t. g^m > modulus
+    std::size_t log_g = 28;          // g = 2^log_g
+    std::size_t mod_plaintext = 50;  // bit size of the plaintext modulus
+    std::size_t mod_noise = 59;      // bit size of the second prime of the ciphertext modulus
+    bool balanced = false;           // gadget digits in [-g/2, g/2) instead of [0, g) (set as "gadget = unsigned|balanced")
+
+    // depth of the Lenc tree, = log_2 w
+    std::size_t l() const;
+
+    std::uint64_t g() const {
+        return std::uint64_t(1) << log_g;
+    }
+
+    // number of labels, i.e., the length of the vectors l1, l2, and y
+    std::size_t label_count() const {
+        return w * poly_modulus_degree;
+    }
+
+    /**
+    Sets the parameter with the given name (one of the member names above, with
+    the same meaning). Throws std::invalid_argument for unknown names or values.
+    */
+    void set(const std::string &name, const std::string &value);
+
+    /**
+    Reads parameters from a stream with one "name = value" pair per line. Everything
+    from a '#' to the end of the line is a comment; empty lines are ignored.
+    */
+    void load(std::istream &in);
+    void save(std::ostream &out) const;
+
+    /**
+    Estimated bit size of the decryption error, i.e., of the sum of the (l*2m + m)*N products
+    of the small ciphertext errors with the gadget digits in Lenc::eval and LHE::dec (the error
+    of ct2 is negligible in comparison). The products are independent with mean 0, so their
+    sum has variance (l*2m + m)*N*sigma^2*E[d^2], where E[d^2] is g^2/3 for unsigned digits and
+    g^2/12 for balanced ones; the estimate is 16 standard deviations, far in the tail.
+    */
+    double noise_bits() const;
+
+    /**
+    Throws std::invalid_argument if the parameters do not describe a valid instance, including
+    when the error may exceed a quarter of the second prime (noise_bits() > mod_noise - 2), and when
+    SEAL does not accept the encryption parameters (e.g., a modulus too large for the security
+    level of poly_modulus_degree).
+    */
+    void validate() const;
+
+    // The ciphertext modulus consists of the plaintext modulus and one additional prime.
+    seal::EncryptionParameters encryption_parameters() const;
+};
+
+std::ostream &operator<<(std::ostream &out, const BatchSelectParams &params);
+
+/**
+Options shared by the command line tools.
+*/
+struct Options {
+    BatchSelectParams params;
+    std::size_t threads;
+    bool seeded_pp = true; // whether setup stores only the seeds of the public parameters
+    bool packed = false;   // whether ciphertexts, states and keys are stored bit-packed (see packing.h)
+    bool binary_labels = false; // whether l1, l2, y and the output are stored in binary (see labels.h)
+    std::string digest_cache;   // file caching the Lenc digest of y for keygen and dec (see BatchSelect::digest_cache)
+    bool leaf_major = false;    // whether enc1 stores the Lenc ciphertext in leaf-major layout (see CtLayout)
+    std::size_t queries = 1;    // number of choice vectors y handled by gen_samples, keygen, and dec (see BatchSelect::dec_many)
+    std::size_t stream_window = 0; // if positive, enc1 writes the Lenc ciphertext while computing it, in batches of this many blocks
+    std::size_t dec_slice = 0;  // if positive, dec decrypts and writes the output in slices of this many blocks (see BatchSelect::dec)
+};
+
+// Base name of the file of query q (like "y" or "sk"): the name itself for a single query, and "<name><q>" otherwise.
+std::string query_name(const std::string &name, const Options &options, std::size_t q);
+
+/**
+Parses the command line of a tool. Accepted are "--params <file>" (a file as read by
+BatchSelectParams::load), "--threads <n>", "--pp seeded|raw", "--format words|packed",
+"--labels text|binary", "--ct-layout level|leaf", "--digest-cache <file>", "--queries <n>",
+"--stream-window <blocks>", "--dec-slice <blocks>", and "--<name> <value>" (or "--<name>=<value>")
+for every parameter name. Options are applied from left to right. On errors, or for
+"--help", prints a usage message and exits.
+*/
+Options parse_options(int argc, char **argv);
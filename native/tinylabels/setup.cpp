@@ -4,27 +4,28 @@ using namespace std;
 using namespace seal;
 using namespace seal::util;
 
-int main()
+int main(int argc, char **argv)
 {
-    EncryptionParameters parms(scheme_type::onoff);
-    parms.set_poly_modulus_degree(poly_modulus_degree);
-    parms.set_plain_modulus(PlainModulus::Batching(poly_modulus_degree, mod_plaintext));
+    Options options = parse_options(argc, argv);
+    const BatchSelectParams &params = options.params;
 
-    vector<Modulus> coeff_modulus = CoeffModulus::Create(poly_modulus_degree, {mod_noise});
-    coeff_modulus.insert(coeff_modulus.begin(), parms.plain_modulus());
-    parms.set_coeff_modulus(coeff_modulus);
+    EncryptionParameters parms = params.encryption_parameters();
+    const vector<Modulus> &coeff_modulus = parms.coeff_modulus();
 
     SEALContext context(parms);
     auto &context_data = *context.get_context_data(parms.parms_id());
 
     cout << "Plaintext modulus: " << coeff_modulus[0].value() << "\n";
+    cout << "Parameters: " << params << "\n";
+    cout << "Threads: " << options.threads << "\n";
+    cout << "Kernels: " << select_kernels(context_data).name << "\n";
     cout << "===================\n";
 
     auto prng = UniformRandomGeneratorFactory::DefaultFactory()->create();
 
     auto begin = chrono::steady_clock::now();
 
-    BatchSelect bs(context_data, prng);
+    BatchSelect bs(params, context_data, prng, options.threads);
     bs.setup();
 
     cout << "===================\n";
@@ -32,8 +33,8 @@ int main()
 
     print_statistics();
 
-    FILE *f_pp = fopen("pp.bin", "wb");
-    bs.save_pp(f_pp);
+    FILE *f_pp = fopen("pp.bin", "w+b");
+    bs.save_pp(f_pp, options.seeded_pp);
     fclose(f_pp);
 
     return 0;
@@ -0,0 +1,198 @@
+#include "threadpool.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <stdexcept>
+
+using namespace std;
+
+ThreadPool::ThreadPool(size_t threads) {
+    for (size_t i = 1; i < threads; ++i) {
+        workers_.emplace_back([this] { worker_loop(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard<mutex> lock(mutex_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    for (auto &worker : workers_) {
+        worker.join();
+    }
+}
+
+void ThreadPool::worker_loop() {
+    for (;;) {
+        function<void()> task;
+        {
+            unique_lock<mutex> lock(mutex_);
+            cv_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+            if (tasks_.empty()) return;
+            task = move(tasks_.front());
+            tasks_.pop_front();
+        }
+        task();
+    }
+}
+
+bool ThreadPool::run_pending_task() {
+    function<void()> task;
+    {
+        lock_guard<mutex> lock(mutex_);
+        if (tasks_.empty()) return false;
+        task = move(tasks_.front());
+        tasks_.pop_front();
+    }
+    task();
+    return true;
+}
+
+void ThreadPool::parallel_for(size_t count, const function<void(size_t, size_t)> &body) {
+    if (!count) return;
+    size_t parts = min(count, size());
+    if (parts == 1) {
+        body(0, count);
+        return;
+    }
+
+    struct State {
+        mutex m;
+        condition_variable done;
+        size_t remaining;
+        exception_ptr error;
+    };
+    auto state = make_shared<State>();
+    state->remaining = parts;
+
+    // part i covers [i*count/parts, (i+1)*count/parts)
+    auto run_part = [state, &body, count, parts](size_t i) {
+        try {
+            body(i*count/parts, (i+1)*count/parts);
+        } catch (...) {
+            lock_guard<mutex> lock(state->m);
+            if (!state->error) state->error = current_exception();
+        }
+        lock_guard<mutex> lock(state->m);
+        if (!--state->remaining) state->done.notify_all();
+    };
+
+    {
+        lock_guard<mutex> lock(mutex_);
+        for (size_t i = 1; i < parts; ++i) {
+            tasks_.emplace_back([run_part, i] { run_part(i); });
+        }
+    }
+    cv_.notify_all();
+
+    run_part(0);
+
+    for (;;) {
+        {
+            lock_guard<mutex> lock(state->m);
+            if (!state->remaining) break;
+        }
+        if (run_pending_task()) continue;
+        // all of our parts have been picked up by other threads; wait for them
+        unique_lock<mutex> lock(state->m);
+        state->done.wait(lock, [&] { return !state->remaining; });
+    }
+
+    if (state->error) rethrow_exception(state->error);
+}
+
+void ThreadPool::submit(function<void()> task) {
+    {
+        lock_guard<mutex> lock(mutex_);
+        tasks_.emplace_back(move(task));
+    }
+    cv_.notify_one();
+}
+
+TaskGraph::Task TaskGraph::add(function<void()> body, const vector<Task> &dependencies) {
+    Task task = nodes_.size();
+    for (Task dependency : dependencies) {
+        if (dependency >= task) throw invalid_argument("a task can only depend on tasks added before it");
+        nodes_[dependency].dependents.push_back(task);
+    }
+    nodes_.push_back({ move(body), {}, dependencies.size() });
+    return task;
+}
+
+void TaskGraph::run() {
+    struct State {
+        mutex m;
+        condition_variable progress;
+        size_t remaining;
+        vector<size_t> pending;
+        exception_ptr error;
+    };
+    auto state = make_shared<State>();
+    state->remaining = nodes_.size();
+    for (const Node &node : nodes_) {
+        state->pending.push_back(node.dependency_count);
+    }
+
+    // a finished task submits the dependents that became ready, and wakes the caller, which
+    // may then pick them up
+    function<void(Task)> start = [this, state, &start](Task task) {
+        pool_.submit([this, state, &start, task] {
+            bool failed;
+            {
+                lock_guard<mutex> lock(state->m);
+                failed = static_cast<bool>(state->error);
+            }
+            if (!failed) {
+                try {
+                    nodes_[task].body();
+                } catch (...) {
+                    lock_guard<mutex> lock(state->m);
+                    if (!state->error) state->error = current_exception();
+                }
+            }
+
+            vector<Task> ready;
+            {
+                lock_guard<mutex> lock(state->m);
+                for (Task dependent : nodes_[task].dependents) {
+                    if (!--state->pending[dependent]) ready.push_back(dependent);
+                }
+            }
+            for (Task dependent : ready) {
+                start(dependent);
+            }
+
+            lock_guard<mutex> lock(state->m);
+            --state->remaining;
+            state->progress.notify_all();
+        });
+    };
+    for (Task task = 0; task < nodes_.size(); ++task) {
+        if (!nodes_[task].dependency_count) start(task);
+    }
+
+    for (;;) {
+        size_t remaining;
+        {
+            lock_guard<mutex> lock(state->m);
+            remaining = state->remaining;
+        }
+        if (!remaining) break;
+        if (pool_.run_pending_task()) continue;
+        // all ready tasks are running on other threads; wait until one of them is done
+        unique_lock<mutex> lock(state->m);
+        state->progress.wait(lock, [&] { return state->remaining != remaining; });
+    }
+
+    if (state->error) rethrow_exception(state->error);
+}
+
+size_t default_thread_count() {
+    if (const char *env = getenv("TINYLABELS_THREADS")) {
+        size_t threads = strtoull(env, nullptr, 10);
+        if (threads) return threads;
+    }
+    return max<size_t>(1, thread::hardware_concurrency());
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+A fixed-size pool of worker threads.
+
+A pool of size n uses n-1 worker threads; the thread calling parallel_for always
+takes part in the work, so a pool of size 1 runs everything inline. While a caller
+waits for its own work to finish, it executes other pending tasks, so nested calls
+to parallel_for (from inside a task) cannot deadlock.
+*/
+class ThreadPool {
+public:
+
+    explicit ThreadPool(std::size_t threads = 1);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    std::size_t size() const {
+        return workers_.size() + 1;
+    }
+
+    /**
+    Splits [0, count) into at most size() contiguous ranges and calls body(begin, end)
+    once for each of them. The partition only depends on count and size(), and every
+    index is processed exactly once. Returns after all ranges are done; the first
+    exception thrown by body is rethrown in the caller.
+    */
+    void parallel_for(std::size_t count, const std::function<void(std::size_t, std::size_t)> &body);
+
+private:
+    friend class TaskGraph;
+
+    void worker_loop();
+    bool run_pending_task();
+    void submit(std::function<void()> task);
+
+    std::vector<std::thread> workers_;
+    std::deque<std::function<void()>> tasks_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+};
+
+/**
+A set of tasks with dependencies between them, run on a ThreadPool.
+
+run() starts every task as soon as all tasks it depends on are done, so independent tasks
+run at the same time, and the running time is determined by the longest chain of dependent
+tasks rather than by the sum of all tasks. A task can use parallel_for on the same pool for
+its subtasks, which are then interleaved with the subtasks of the other running tasks.
+*/
+class TaskGraph {
+public:
+    using Task = std::size_t;
+
+    explicit TaskGraph(ThreadPool &pool) : pool_(pool) {}
+
+    // Adds a task that runs body after all tasks in dependencies are done.
+    Task add(std::function<void()> body, const std::vector<Task> &dependencies = {});
+
+    /**
+    Runs all tasks, and returns after they are done; the calling thread takes part in the
+    work. If a task throws, the tasks that have not started yet are skipped, and the first
+    exception is rethrown in the caller.
+    */
+    void run();
+
+private:
+    struct Node {
+        std::function<void()> body;
+        std::vector<Task> dependents;
+        std::size_t dependency_count;
+    };
+
+    ThreadPool &pool_;
+    std::vector<Node> nodes_;
+};
+
+/**
+Number of threads used by the command line tools: the value of the environment
+variable TINYLABELS_THREADS if set, and the number of hardware threads otherwise.
+*/
+std::size_t default_thread_count();